@@ -23,3 +23,5 @@
 #define CLAPP_ID_CONTROL_AUDIO_LATENCY 0x9
 #define CLAPP_ID_CONTROL_FRAMERATE 0xa
 #define CLAPP_ID_CONTROL_OPENCL_INFO 0xb
+#define CLAPP_ID_CONTROL_FRAMES_IN_FLIGHT 0xc
+#define CLAPP_ID_CONTROL_RENDER_SCALE 0xd
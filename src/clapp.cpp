@@ -25,6 +25,9 @@ static App*                g_app { nullptr };
 static Application::Params g_app_params { 0 };
 
 // TODO: Fix sound sluttering after window resize or move
+// NOTE: The modal move/size loop and the settings dialog block the update callback, and every
+// audio frame is generated and submitted by update, so the fix needs RTL to call update on a
+// render thread, which owns the GL context and presents by itself.
 int main( int, char*[] )
 {
     // TODO: Remember fullscreen state
@@ -51,6 +54,11 @@ int main( int, char*[] )
             {
                 return Application::Action::close;
             }
+            else if ( g_app->recording() )
+            {
+                // NOTE: The state, the program and the window are left intact while recording, so
+                // the render depends on the command line only
+            }
             else if ( input.keys.pressed[Keys::f1] )
             {
                 g_app->toggle_help();
@@ -64,7 +72,7 @@ int main( int, char*[] )
                 g_app->load_state();
             }
 #if CLAPP_ENABLE_ARCHITECT_MODE
-            else if ( input.keys.pressed[keys::f5] )
+            else if ( input.keys.pressed[Keys::f5] )
             {
                 g_app->reload_program();
             }
@@ -92,6 +100,10 @@ int main( int, char*[] )
             }
 #endif
             g_app->update( input, output );
+
+            if ( g_app->recording_completed() )
+                return Application::Action::close;
+
             return Application::Action::none;
         },
         []()
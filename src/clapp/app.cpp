@@ -9,14 +9,25 @@
  * https://github.com/out61h/clapp/blob/main/LICENSE.
  */
 #include "app.hpp"
+#include "audio_meter.hpp"
 #include "context.hpp"
 #include "font.hpp"
+#include "frame_meter.hpp"
+#include "governor.hpp"
 #include "hud.hpp"
+#include "recorder.hpp"
 #include "renderer.hpp"
 #include "settings.hpp"
+#include "text.hpp"
 
 #include <clapp.h>
 
+#pragma warning( push )
+#pragma warning( disable : 4668 )
+#define NOMINMAX
+#include <Windows.h>
+#pragma warning( pop )
+
 using namespace clapp;
 
 namespace strings
@@ -43,10 +54,46 @@ namespace ui
     {
         return 20 * screen_width / 1280;
     }
+
+    int scale( int size, float factor )
+    {
+        const int result = static_cast<int>( static_cast<float>( size ) * factor + .5f );
+
+        return result > 0 ? result : 1;
+    }
+
+    // Appends microseconds as milliseconds
+    Text& ms( Text& text, unsigned us )
+    {
+        return text.append_decimal( static_cast<float>( us ) / 1000.f );
+    }
+
+    Text& stage_time( Text& text, const Context& context, Context::Stage stage )
+    {
+        return text.append_integer( static_cast<int>( context.stage_time( stage ) ) )
+            .append( L" us" );
+    }
+
+    Text& stage_bandwidth( Text& text, const Context& context, Context::Stage stage )
+    {
+        return text.append( L" (" )
+            .append_decimal( context.stage_bandwidth( stage ) )
+            .append( L" GB/s)" );
+    }
+}
+
+namespace timings
+{
+    // NOTE: Recording runs within this budget per display frame to keep the window responsive
+    constexpr rtl::chrono::microseconds recording_budget { 15000 };
+
+    // NOTE: One minute, so a crash loses at most that much of the session
+    constexpr rtl::chrono::microseconds autosave_period { 60 * 1000 * 1000 };
 }
 
 App::App()
     : m_hud( rtl::make_unique<Hud>() )
+    , m_frame_meter( rtl::make_unique<FrameMeter>() )
 {
     show_help( true );
 }
@@ -68,10 +115,15 @@ void App::show_stats( bool show )
 {
     m_show_stats = show;
 
+    if ( m_context )
+        m_context->set_profiling( m_show_stats );
+
+    m_hud->set_frame_meter( m_show_stats ? m_frame_meter.get() : nullptr );
+
     if ( !m_show_stats )
     {
-        m_hud->set_stat_line( 0, L"" );
-        m_hud->set_stat_line( 1, L"" );
+        for ( unsigned i = 0; i < Hud::stat_lines_count; ++i )
+            m_hud->set_stat_line( i, L"" );
     }
 }
 
@@ -108,8 +160,6 @@ void App::save_state()
 void App::reload_program()
 {
     m_context->load_program( filenames::program );
-    // TODO: Take from resources
-    m_hud->add_message( L"Program loaded successfully." );
 }
 
 bool App::setup( const rtl::Application::Environment& envir, rtl::Application::Params& params )
@@ -119,8 +169,20 @@ bool App::setup( const rtl::Application::Environment& envir, rtl::Application::P
         m_settings = rtl::make_unique<Settings>();
         m_settings->load( filenames::settings );
 
-        if ( !m_settings->setup( nullptr, envir.display.framerate ) )
+        Recorder::Params recorder_params;
+
+        if ( Recorder::parse_command_line( ::GetCommandLineW(), recorder_params ) )
+        {
+            if ( !m_settings->setup_unattended( envir.display.framerate ) )
+                return false;
+
+            m_recorder = rtl::make_unique<Recorder>( recorder_params,
+                                                     m_settings->target_audio_sample_rate() );
+        }
+        else if ( !m_settings->setup( nullptr, envir.display.framerate ) )
+        {
             return false;
+        }
     }
     else
     {
@@ -139,17 +201,23 @@ bool App::setup( const rtl::Application::Environment& envir, rtl::Application::P
     params.audio.samples_per_second  = m_settings->target_audio_sample_rate();
     params.audio.max_latency_samples = m_settings->target_audio_max_latency();
 
+    // NOTE: The audio device is reopened with the new params, so the counters start over
+    if ( !m_recorder )
+        m_audio_meter = rtl::make_unique<AudioMeter>( params.audio.samples_per_second,
+                                                      params.audio.max_latency_samples );
+
     return true;
 }
 
 void App::init( const rtl::Application::Environment& envir, const rtl::Application::Input& input )
 {
+    const bool context_created = !m_context;
+
     // NOTE: class \Context depends on OpenGL context, so we should initialize it
     // in \on_init callback which is called after OpenGL context was initialized.
     if ( !m_context )
     {
         // TODO: Compile source once and cache compiled binaries in the file.
-        // TODO: Compile program in async manner, display status (progress???)
         m_context = rtl::make_unique<Context>( m_settings->target_opencl_device() );
 #if !CLAPP_ENABLE_ARCHITECT_MODE
         auto program = envir.resources.open( FILE, CLAPP_ID_OPENCL_PROGRAM );
@@ -158,33 +226,98 @@ void App::init( const rtl::Application::Environment& envir, const rtl::Applicati
 
         m_context->load_program( source );
 #else
-        context->load_program( filenames::program );
+        m_context->load_program( filenames::program );
 #endif
-        m_context->load_state( filenames::auto_save );
+
+        m_context->set_profiling( m_show_stats );
     }
 
     if ( !m_renderer )
         m_renderer = rtl::make_unique<Renderer>();
 
+    const unsigned render_scale = m_settings->target_render_scale();
+
+    // NOTE: Zero render scale stands for the automatic one
+    if ( render_scale == 0 && !m_recorder )
+    {
+        if ( !m_governor )
+            m_governor = rtl::make_unique<Governor>( envir.display.framerate );
+
+        m_render_scale = 1.f;
+        m_video_scale  = m_governor->scale();
+    }
+    else
+    {
+        m_governor.reset();
+        m_render_scale = 1.f / static_cast<float>( render_scale != 0 ? render_scale : 1 );
+        m_video_scale  = 1.f;
+    }
+
     m_font = rtl::make_unique<Font>( ui::font_size( input.screen.width ) );
 
     m_hud->init( input.screen.width, input.screen.height );
-    m_renderer->init( input.screen.width, input.screen.height );
-    m_context->init( input, m_renderer->texture() );
+
+    if ( m_recorder )
+    {
+        const rtl::Application::Input recorder_input = m_recorder->input( input );
+
+        // NOTE: Frames are read back right after rendering, so there are no frames in flight
+        m_renderer->init( input.screen.width,
+                          input.screen.height,
+                          recorder_input.screen.width,
+                          recorder_input.screen.height,
+                          1 );
+        m_context->init( recorder_input,
+                         m_renderer->textures(),
+                         recorder_input.screen.width,
+                         recorder_input.screen.height );
+    }
+    else
+    {
+        init_video( input );
+    }
+
+    // NOTE: The state is sized for the screen on \Context::init, so it is loaded afterwards.
+    // Recording always starts from the initial state.
+    if ( context_created && !m_recorder )
+    {
+        m_context->load_state( filenames::auto_save );
+        m_autosave_start = rtl::chrono::steady_clock::now();
+
+        // NOTE: The first frame time is measured from here
+        m_frame_start = m_autosave_start;
+    }
 }
 
 void App::update( const rtl::Application::Input& input, rtl::Application::Output& output )
 {
+    if ( m_recorder )
+    {
+        record( input, output );
+        return;
+    }
+
     auto start = rtl::chrono::steady_clock::now();
 
     rtl::chrono::microseconds ft = start - m_frame_start;
 
     m_frame_start = rtl::chrono::steady_clock::now();
+    m_frame_meter->add( ft );
 
     m_context->update( input, output );
+    m_audio_meter->update( start, static_cast<unsigned>( input.audio.samples_per_frame ) );
+
+    const rtl::chrono::microseconds autosave_elapsed = start - m_autosave_start;
+
+    if ( autosave_elapsed.count() >= timings::autosave_period.count()
+         && m_context->save_state_async( filenames::auto_save ) )
+        m_autosave_start = start;
+
+    update_program_progress();
+
     m_hud->update( rtl::chrono::thirds( input.clock.third_ticks ) );
 
-    m_renderer->draw();
+    m_renderer->draw( m_context->video_frame_index() );
     m_hud->draw( *m_font.get() );
 
     auto end = rtl::chrono::steady_clock::now();
@@ -192,16 +325,245 @@ void App::update( const rtl::Application::Input& input, rtl::Application::Output
     rtl::chrono::microseconds delta = end - start;
     // process delta in ms
 
+    // NOTE: Profiling waits for every stage, so the render time is not measured with the stats on
+    if ( m_governor && m_context->video_scalable() && !m_show_stats
+         && m_governor->update( delta ) )
+        m_video_scale = m_governor->scale();
+
+    // NOTE: The scale also changes, when the program switches to or from the scalable video
+    if ( video_scale() != m_applied_video_scale )
+        resize_video( input );
+
     if ( m_show_stats )
+        update_stats( input, ft, delta );
+}
+
+void App::update_stats( const rtl::Application::Input& input,
+                        rtl::chrono::microseconds      frame_time,
+                        rtl::chrono::microseconds      render_time )
+{
+    // NOTE: Lines are formatted on the stack, so the stats don't allocate
+    Text line;
+
+    line.append( L"Render time:  " ).append_integer( render_time.count() );
+    m_hud->set_stat_line( 0, line.view() );
+
+    const FrameMeter::Summary frames = m_frame_meter->summary();
+
+    line.clear();
+    line.append( L"Frame time:  " ).append_integer( frame_time.count() ).append( L", min " );
+    ui::ms( line, frames.min ).append( L", avg " );
+    ui::ms( line, frames.mean ).append( L", max " );
+    ui::ms( line, frames.max ).append( L", p50 " );
+    ui::ms( line, frames.p50 ).append( L", p95 " );
+    ui::ms( line, frames.p95 ).append( L", p99 " );
+    ui::ms( line, frames.p99 ).append( L", p99.9 " );
+    ui::ms( line, frames.p999 ).append( L" ms" );
+    m_hud->set_stat_line( 1, line.view() );
+
+    const AudioMeter& audio = *m_audio_meter.get();
+
+    line.clear();
+    line.append( L"Frames late for audio (simulated): " )
+        .append_integer( audio.total().late_frames )
+        .append( L" (" )
+        .append_integer( audio.last_second().late_frames )
+        .append( L"/s), worst " )
+        .append_decimal( audio.worst_delay_ms() )
+        .append( L" ms" );
+    m_hud->set_stat_line( 2, line.view() );
+
+    line.clear();
+    line.append( L"Frames early for audio (simulated): " )
+        .append_integer( audio.total().early_frames )
+        .append( L" (" )
+        .append_integer( audio.last_second().early_frames )
+        .append( L"/s)" );
+    m_hud->set_stat_line( 3, line.view() );
+
+    line.clear();
+    line.append( L"Audio queue (simulated): " )
+        .append_integer( audio.latency_samples() )
+        .append( L" / " )
+        .append_integer( audio.max_latency_samples() )
+        .append( L" samples (" )
+        .append_decimal( audio.latency_ms() )
+        .append( L" ms)" );
+    m_hud->set_stat_line( 4, line.view() );
+
+    using Stage = Context::Stage;
+
+    const Context& context = *m_context.get();
+
+    line.clear();
+    line.append( L"Input:  keys " );
+    ui::stage_time( line, context, Stage::keys_upload );
+    ui::stage_bandwidth( line, context, Stage::keys_upload );
+
+    if ( !context.state_carry() )
     {
-        m_hud->set_stat_line( 0,
-                              rtl::wstring( L"Render time:  " )
-                                  + rtl::to_wstring( delta.count() ) );
-        m_hud->set_stat_line( 1, rtl::wstring( L"Frame time:  " ) + rtl::to_wstring( ft.count() ) );
+        line.append( L", copy " );
+        ui::stage_time( line, context, Stage::state_copy );
+        ui::stage_bandwidth( line, context, Stage::state_copy );
+    }
+
+    line.append( L", kernel " );
+    ui::stage_time( line, context, Stage::input );
+    m_hud->set_stat_line( 5, line.view() );
+
+    line.clear();
+    line.append( L"Video:  acquire " );
+    ui::stage_time( line, context, Stage::video_acquire ).append( L", kernel " );
+    ui::stage_time( line, context, Stage::video_out ).append( L", release " );
+    ui::stage_time( line, context, Stage::video_release );
+    m_hud->set_stat_line( 6, line.view() );
+
+    line.clear();
+    line.append( L"Audio:  kernel " );
+    ui::stage_time( line, context, Stage::audio_out ).append( L", format " );
+    ui::stage_time( line, context, Stage::audio_format ).append( L", readback " );
+    ui::stage_time( line, context, Stage::audio_readback );
+    ui::stage_bandwidth( line, context, Stage::audio_readback );
+    m_hud->set_stat_line( 7, line.view() );
+
+    line.clear();
+    line.append( L"Render:  " )
+        .append_integer( ui::scale( input.screen.width, m_applied_video_scale ) )
+        .append( L"x" )
+        .append_integer( ui::scale( input.screen.height, m_applied_video_scale ) )
+        .append( L" (" )
+        .append_integer( ui::scale( 100, m_applied_video_scale ) )
+        .append( L"%)" );
+
+    if ( !context.video_scalable() )
+        line.append( L", the program renders at the screen size" );
+    else if ( m_governor )
+        line.append( L", auto: " ).append( m_governor->reason() );
+
+    m_hud->set_stat_line( 8, line.view() );
+}
 
-        m_hud->set_stat_line( 2, rtl::wstring( L"Audio underruns: " ) );
-        m_hud->set_stat_line( 3, rtl::wstring( L"Audio overruns: " ) );
-        m_hud->set_stat_line( 4, rtl::wstring( L"Audio latency: " ) );
+void App::record( const rtl::Application::Input& input, rtl::Application::Output& output )
+{
+    const auto start = rtl::chrono::steady_clock::now();
+
+    m_context->switch_program();
+
+    while ( m_context->program_loaded() && !m_recorder->completed() )
+    {
+        m_context->update( m_recorder->input( input ), output );
+        m_renderer->read( m_context->video_frame_index(), m_recorder->pixels() );
+        m_recorder->write_frame();
+
+        const rtl::chrono::microseconds elapsed = rtl::chrono::steady_clock::now() - start;
+
+        if ( elapsed.count() >= timings::recording_budget.count() )
+            break;
+    }
+
+    // NOTE: Recorded audio goes to the file only
+    rtl::int16_t* samples = input.audio.output_frame_pointer;
+
+    for ( size_t i = 0; i < input.audio.samples_per_frame * 2; ++i )
+        *samples++ = 0;
+
+    update_program_progress();
+
+    if ( m_context->program_loaded() )
+    {
+        Text progress;
+
+        // TODO: Take from resources
+        progress.append( L"Recording:  " )
+            .append_integer( m_recorder->frame_index() )
+            .append( L" / " )
+            .append_integer( m_recorder->frames_count() )
+            .append( L" frames, " )
+            .append_integer( m_recorder->framerate() )
+            .append( L" fps" );
+        m_hud->set_progress( progress.view() );
+    }
+
+    m_hud->update( rtl::chrono::thirds( input.clock.third_ticks ) );
+
+    m_renderer->draw( m_context->video_frame_index() );
+    m_hud->draw( *m_font.get() );
+}
+
+void App::init_video( const rtl::Application::Input& input )
+{
+    m_applied_video_scale = video_scale();
+
+    // NOTE: The device must not write to the textures, when they are deleted
+    m_context->wait();
+    init_renderer( input );
+
+    m_context->init( input,
+                     m_renderer->textures(),
+                     ui::scale( input.screen.width, m_applied_video_scale ),
+                     ui::scale( input.screen.height, m_applied_video_scale ) );
+}
+
+void App::resize_video( const rtl::Application::Input& input )
+{
+    m_applied_video_scale = video_scale();
+
+    m_context->wait();
+    init_renderer( input );
+
+    m_context->resize_video( m_renderer->textures(),
+                             ui::scale( input.screen.width, m_applied_video_scale ),
+                             ui::scale( input.screen.height, m_applied_video_scale ) );
+}
+
+void App::init_renderer( const rtl::Application::Input& input )
+{
+    // NOTE: The texture is stretched only if it is downscaled
+    m_renderer->init( input.screen.width,
+                      input.screen.height,
+                      ui::scale( input.screen.width, m_applied_video_scale ),
+                      ui::scale( input.screen.height, m_applied_video_scale ),
+                      m_settings->target_frames_in_flight(),
+                      m_applied_video_scale < 1.f ? Renderer::Filter::linear
+                                                  : Renderer::Filter::nearest );
+}
+
+float App::video_scale() const
+{
+    // NOTE: The program, which doesn't take the screen size, maps the pixels by the image size
+    if ( !m_context->video_scalable() )
+        return 1.f;
+
+    return m_render_scale * m_video_scale;
+}
+
+bool App::recording_completed() const
+{
+    return m_recorder && m_recorder->completed();
+}
+
+void App::update_program_progress()
+{
+    if ( m_context->program_loading() )
+    {
+        rtl::chrono::microseconds elapsed = m_context->program_loading_time();
+
+        Text progress;
+
+        // TODO: Take from resources
+        progress.append( L"Compiling program:  " )
+            .append_integer( elapsed.count() / 1000 )
+            .append( L" ms" );
+        m_hud->set_progress( progress.view() );
+        m_program_loading = true;
+    }
+    else if ( m_program_loading )
+    {
+        m_hud->set_progress( L"" );
+        // TODO: Take from resources
+        m_hud->add_message( m_context->program_failed() ? L"Program build failed."
+                                                        : L"Program loaded successfully." );
+        m_program_loading = false;
     }
 }
 
@@ -212,6 +574,10 @@ void App::clear()
 
 void App::shutdown()
 {
+    // NOTE: Recording must not overwrite the files of the interactive session
+    if ( m_recorder )
+        return;
+
     m_context->save_state( filenames::auto_save );
     // TODO: save/load window geometry
     m_settings->save( filenames::settings );
@@ -21,6 +21,10 @@ namespace clapp
     class Renderer;
     class Font;
     class Context;
+    class Recorder;
+    class Governor;
+    class AudioMeter;
+    class FrameMeter;
 
     class App final
     {
@@ -47,17 +51,53 @@ namespace clapp
 
         void reload_program();
 
+        bool recording() const { return m_recorder.get() != nullptr; }
+        bool recording_completed() const;
+
+        // NOTE: Audio goes to the file while recording, so there is no meter
+        const AudioMeter* audio_meter() const { return m_audio_meter.get(); }
+
     private:
-        rtl::unique_ptr<Settings> m_settings;
-        rtl::unique_ptr<Hud>      m_hud;
-        rtl::unique_ptr<Renderer> m_renderer;
-        rtl::unique_ptr<Font>     m_font;
-        rtl::unique_ptr<Context>  m_context;
+        void record( const rtl::Application::Input& input, rtl::Application::Output& output );
+        void update_program_progress();
+        void update_stats( const rtl::Application::Input& input,
+                           rtl::chrono::microseconds      frame_time,
+                           rtl::chrono::microseconds      render_time );
+
+        // (Re)creates the textures and the frames at the video resolution
+        void init_video( const rtl::Application::Input& input );
+
+        // Recreates the textures at the video resolution, the state is kept
+        void resize_video( const rtl::Application::Input& input );
+
+        // (Re)creates the textures at the applied video scale
+        void init_renderer( const rtl::Application::Input& input );
+
+        // Video to screen resolution ratio, which the settings, the governor and the program allow
+        float video_scale() const;
+
+        rtl::unique_ptr<Settings>   m_settings;
+        rtl::unique_ptr<Hud>        m_hud;
+        rtl::unique_ptr<Renderer>   m_renderer;
+        rtl::unique_ptr<Font>       m_font;
+        rtl::unique_ptr<Context>    m_context;
+        rtl::unique_ptr<Recorder>   m_recorder;
+        rtl::unique_ptr<Governor>   m_governor;
+        rtl::unique_ptr<AudioMeter> m_audio_meter;
+        rtl::unique_ptr<FrameMeter> m_frame_meter;
 
         rtl::chrono::steady_clock::time_point m_frame_start;
+        rtl::chrono::steady_clock::time_point m_autosave_start;
+
+        // NOTE: Both scale the video only, the state keeps the screen size. The render scale is
+        // set by the settings, the video scale is set by the governor.
+        float m_render_scale { 1.f };
+        float m_video_scale { 1.f };
+        float m_applied_video_scale { 1.f };
 
         bool m_show_help { false };
         bool m_show_stats { false };
-        bool m_pad[2];
+        bool m_program_loading { false };
+        bool m_pad[1];
     };
 }
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#include "audio_meter.hpp"
+
+using namespace clapp;
+
+namespace
+{
+    constexpr rtl::chrono::microseconds counters_period { 1000000 };
+
+    // NOTE: Updates follow the vsync, so a frame may come up to a frame early or late without
+    // being counted
+    constexpr float jitter_tolerance_frames = 1.f;
+
+    void count_late( AudioMeter::Counters& total, AudioMeter::Counters& second )
+    {
+        ++total.late_frames;
+        ++second.late_frames;
+    }
+
+    void count_early( AudioMeter::Counters& total, AudioMeter::Counters& second )
+    {
+        ++total.early_frames;
+        ++second.early_frames;
+    }
+}
+
+AudioMeter::AudioMeter( unsigned samples_per_second, unsigned max_latency_samples )
+    : m_samples_per_second( samples_per_second )
+    , m_max_latency_samples( max_latency_samples )
+    , m_queued( static_cast<float>( max_latency_samples ) )
+{
+}
+
+void AudioMeter::update( rtl::chrono::steady_clock::time_point now, unsigned samples )
+{
+    // NOTE: The queue is assumed to be prebuffered, when the first frame comes, so nothing is
+    // drained before it
+    if ( !m_started )
+    {
+        m_last_update  = now;
+        m_second_start = now;
+        m_started      = true;
+    }
+
+    const rtl::chrono::microseconds elapsed = now - m_last_update;
+
+    m_last_update = now;
+    m_queued -= static_cast<float>( elapsed.count() ) * static_cast<float>( m_samples_per_second )
+              / 1000000.f;
+
+    const float tolerance = static_cast<float>( samples ) * jitter_tolerance_frames;
+
+    // NOTE: The simulated queue has been drained before this frame came
+    if ( m_queued < -tolerance )
+    {
+        count_late( m_total, m_second );
+
+        if ( -m_queued > m_worst_delay )
+            m_worst_delay = -m_queued;
+    }
+
+    if ( m_queued < 0.f )
+        m_queued = 0.f;
+
+    m_queued += static_cast<float>( samples );
+
+    const float max_queued = static_cast<float>( m_max_latency_samples );
+
+    // NOTE: The queue doesn't hold more than the maximum latency, the rest is assumed dropped
+    if ( m_queued > max_queued + tolerance )
+        count_early( m_total, m_second );
+
+    if ( m_queued > max_queued )
+        m_queued = max_queued;
+
+    const rtl::chrono::microseconds second_elapsed = now - m_second_start;
+
+    if ( second_elapsed.count() >= counters_period.count() )
+    {
+        m_last_second  = m_second;
+        m_second       = Counters();
+        m_second_start = now;
+    }
+}
+
+unsigned AudioMeter::latency_samples() const
+{
+    return static_cast<unsigned>( m_queued + .5f );
+}
+
+float AudioMeter::latency_ms() const
+{
+    return to_ms( m_queued );
+}
+
+float AudioMeter::worst_delay_ms() const
+{
+    return to_ms( m_worst_delay );
+}
+
+float AudioMeter::to_ms( float samples ) const
+{
+    return m_samples_per_second != 0 ? samples * 1000.f / static_cast<float>( m_samples_per_second )
+                                     : 0.f;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#pragma once
+
+#include <rtl/chrono.hpp>
+
+namespace clapp
+{
+    // Frame jitter against the audio output queue. The queue is simulated by the host clock: it is
+    // drained at the sample rate, and every update appends one audio frame to it.
+    // NOTE: RTL doesn't expose the queue of the audio device, so these are not the underruns and
+    // the overruns of the device. Frames, which come later or earlier than the simulated queue
+    // allows, are counted. The simulation starts from the prebuffered queue and tolerates a frame
+    // of jitter.
+    class AudioMeter final
+    {
+    public:
+        struct Counters
+        {
+            // NOTE: The simulated queue has run dry before these frames
+            unsigned late_frames { 0 };
+
+            // NOTE: The simulated queue has been full before these frames
+            unsigned early_frames { 0 };
+        };
+
+        AudioMeter( unsigned samples_per_second, unsigned max_latency_samples );
+
+        void update( rtl::chrono::steady_clock::time_point now, unsigned samples );
+
+        // Counters since the initialization
+        const Counters& total() const { return m_total; }
+
+        // Counters of the previous whole second
+        const Counters& last_second() const { return m_last_second; }
+
+        // Samples of the simulated queue after the latest update
+        unsigned latency_samples() const;
+        float    latency_ms() const;
+
+        unsigned max_latency_samples() const { return m_max_latency_samples; }
+
+        // Longest delay of a late frame past the end of the simulated queue
+        float worst_delay_ms() const;
+
+    private:
+        float to_ms( float samples ) const;
+
+        unsigned m_samples_per_second;
+        unsigned m_max_latency_samples;
+
+        float m_queued;
+        float m_worst_delay { 0.f };
+
+        Counters m_total;
+        Counters m_second;
+        Counters m_last_second;
+
+        rtl::chrono::steady_clock::time_point m_last_update;
+        rtl::chrono::steady_clock::time_point m_second_start;
+        bool                                  m_started { false };
+    };
+}
@@ -10,26 +10,262 @@
  */
 #include "context.hpp"
 
-#include <rtl/algorithm.hpp>
-#include <rtl/limits.hpp>
+#include <rtl/sys/debug.hpp>
 #include <rtl/sys/filesystem.hpp>
 
+#pragma warning( push )
+#pragma warning( disable : 4668 )
+#define NOMINMAX
+#include <Windows.h>
+#pragma warning( pop )
+
 using namespace clapp;
 
-namespace fs = rtl::filesystem;
+namespace
+{
+    // NOTE: Prepended to the program source to let kernels know about the host configuration
+    constexpr char program_prologue[] {
+        // The state is the grid of CLAPP_STATE_GRID_SIZE( screen width ) x
+        // CLAPP_STATE_GRID_SIZE( screen height ) cells followed by the tables, so the tables
+        // start at ( state length - CLAPP_STATE_TABLES_SIZE ), if the program defines
+        // CLAPP_STATE_SCREEN_GRID. Otherwise the grid is sized for 7680x4320 at any screen, and
+        // the tables stay at their fixed offset. The grid size is rounded up, so the cells cover
+        // the edge pixels as well.
+        "#define CLAPP_STATE_CELL_SIZE 4\n"
+        "#define CLAPP_STATE_GRID_SIZE( screen_size ) "
+        "( ( ( screen_size ) + CLAPP_STATE_CELL_SIZE - 1 ) / CLAPP_STATE_CELL_SIZE )\n"
+        "#define CLAPP_STATE_TABLES_SIZE 131072\n"
+        // \main_video_out covers the whole screen of \main_input with its image. If the program
+        // defines CLAPP_VIDEO_SCREEN_SIZE, \main_video_out takes the screen width and height
+        // after the image, and the image may be smaller than the screen, when the render is
+        // downscaled. The pixels are mapped to the cells by the ratio of the screen size to the
+        // image size then. Otherwise the image is always of the screen size.
+        // \keys of \main_input are 1 while the key is held. The keys are followed by the input
+        // events of the frame: the events count and the events count pairs of
+        // ( key | CLAPP_INPUT_EVENT_PRESSED, audio samples generated before the event )
+        "#define CLAPP_INPUT_EVENTS_MAX 32\n"
+        "#define CLAPP_INPUT_EVENT_PRESSED 0x100\n"
+        // NOTE: Keeps the line numbers of the build log matching the program source
+        "#line 1\n"
+    };
+
+    // NOTE: The program defines it, if \main_input writes every cell of the next state. The host
+    // doesn't copy the current state to the next one for such a program.
+    constexpr rtl::string_view state_carry_marker { "#define CLAPP_STATE_CARRY" };
+
+    // NOTE: The program defines it, if it finds the tables by CLAPP_STATE_TABLES_SIZE, so the
+    // state can be sized for the screen
+    constexpr rtl::string_view state_screen_grid_marker { "#define CLAPP_STATE_SCREEN_GRID" };
+
+    // NOTE: The program defines it, if \main_video_out takes the screen size, so its image can be
+    // downscaled
+    constexpr rtl::string_view video_screen_size_marker { "#define CLAPP_VIDEO_SCREEN_SIZE" };
+
+    // NOTE: Screen, which the state of the programs with the fixed tables offset is sized for
+    constexpr int fixed_state_screen_width  = 7680;
+    constexpr int fixed_state_screen_height = 4320;
+
+    static_assert( Snapshot::Layout::tables_cells_count == 131072,
+                   "CLAPP_STATE_TABLES_SIZE mismatch" );
+
+    constexpr rtl::uint32_t input_event_pressed = 0x100;
+
+    // NOTE: Appended to the program source, these kernels are run by the host
+    constexpr char program_epilogue[] {
+        "\n"
+        // Converts \main_audio_out float samples into interleaved 16-bit stereo samples
+        "__kernel void clapp_audio_format( __global const float* left,\n"
+        "                                  __global const float* right,\n"
+        "                                  __global uint* samples )\n"
+        "{\n"
+        "    const size_t i = get_global_id( 0 );\n"
+        "    const short  l = convert_short_sat( clamp( left[i] * 32767.f, -32767.f, 32767.f ) );\n"
+        "    const short  r = convert_short_sat( clamp( right[i] * 32767.f, -32767.f, 32767.f ) );\n"
+        "    samples[i] = (uint)(ushort)l | ( (uint)(ushort)r << 16 );\n"
+        "}\n"
+        // Expands the bit-packed key states and copies the input events after them
+        "__kernel void clapp_input_unpack( __global const uint* packed, __global uint* keys )\n"
+        "{\n"
+        "    const uint i = get_global_id( 0 );\n"
+        "    if ( i < 256 )\n"
+        "        keys[i] = ( packed[i / 32] >> ( i % 32 ) ) & 1;\n"
+        "    else if ( i == 256 || i - 257 < packed[8] * 2 )\n"
+        "        keys[i] = packed[i - 256 + 8];\n"
+        "}\n"
+    };
+
+    // FNV-1a
+    rtl::uint64_t hash( rtl::string_view data, rtl::uint64_t seed = 0xcbf29ce484222325ull )
+    {
+        for ( char c : data )
+        {
+            seed ^= static_cast<unsigned char>( c );
+            seed *= 0x100000001b3ull;
+        }
+
+        return seed;
+    }
+
+    bool contains( rtl::string_view text, rtl::string_view pattern )
+    {
+        for ( size_t i = 0; i + pattern.size() <= text.size(); ++i )
+        {
+            size_t matched = 0;
+
+            while ( matched < pattern.size() && text[i + matched] == pattern[matched] )
+                ++matched;
+
+            if ( matched == pattern.size() )
+                return true;
+        }
+
+        return false;
+    }
+}
+
+// Builds the program on a background thread, so the frame loop keeps running meanwhile
+class Context::ProgramBuild final
+{
+public:
+    ProgramBuild( rtl::opencl::context& context, rtl::string source, rtl::uint64_t hash )
+        : m_context( context )
+        , m_source( rtl::move( source ) )
+        , m_hash( hash )
+        , m_start( rtl::chrono::steady_clock::now() )
+    {
+        state_carry       = contains( m_source, state_carry_marker );
+        state_screen_grid = contains( m_source, state_screen_grid_marker );
+        video_screen_size = contains( m_source, video_screen_size_marker );
+
+        m_thread = ::CreateThread( nullptr, 0, &ProgramBuild::run, this, 0, nullptr );
+        RTL_ASSERT( m_thread != nullptr );
+    }
+
+    ~ProgramBuild()
+    {
+        ::WaitForSingleObject( m_thread, INFINITE );
+        ::CloseHandle( m_thread );
+    }
+
+    bool completed() const { return ::WaitForSingleObject( m_thread, 0 ) == WAIT_OBJECT_0; }
+
+    // NOTE: Valid once the build is completed
+    bool succeeded() const
+    {
+        DWORD code = 1;
+        ::GetExitCodeThread( m_thread, &code );
+        return code == 0;
+    }
+
+    rtl::uint64_t hash() const { return m_hash; }
+
+    rtl::chrono::microseconds elapsed() const
+    {
+        return rtl::chrono::steady_clock::now() - m_start;
+    }
+
+    rtl::opencl::program program;
+    rtl::opencl::kernel  kernel_input;
+    rtl::opencl::kernel  kernel_input_unpack;
+    rtl::opencl::kernel  kernel_audio_format;
+
+    bool state_carry { false };
+    bool state_screen_grid { false };
+    bool video_screen_size { false };
+
+private:
+    ProgramBuild( const ProgramBuild& )            = delete;
+    ProgramBuild& operator=( const ProgramBuild& ) = delete;
+
+    static DWORD WINAPI run( LPVOID param )
+    {
+        ProgramBuild* build = static_cast<ProgramBuild*>( param );
+
+        build->program = build->m_context.build_program( build->m_source );
+
+        // NOTE: Handles are empty, if the build or the kernel lookup fails
+        if ( !build->program )
+            return 1;
+
+        build->kernel_input        = build->program.create_kernel( "main_input" );
+        build->kernel_input_unpack = build->program.create_kernel( "clapp_input_unpack" );
+        build->kernel_audio_format = build->program.create_kernel( "clapp_audio_format" );
+
+        // NOTE: The output kernels are created per buffer on bind, so they are only looked up here
+        const rtl::opencl::kernel video_out = build->program.create_kernel( "main_video_out" );
+        const rtl::opencl::kernel audio_out = build->program.create_kernel( "main_audio_out" );
+
+        const bool kernels_found = build->kernel_input && build->kernel_input_unpack
+                                && build->kernel_audio_format && video_out && audio_out;
+
+        return kernels_found ? 0 : 1;
+    }
+
+    rtl::opencl::context&                 m_context;
+    rtl::string                           m_source;
+    rtl::uint64_t                         m_hash;
+    rtl::chrono::steady_clock::time_point m_start;
+    HANDLE                                m_thread { nullptr };
+};
+
+// Writes the state snapshot on a background thread
+class Context::StateSave final
+{
+public:
+    StateSave( const wchar_t* filename, const Snapshot::Layout& layout, const rtl::uint32_t* cells )
+        : m_filename( filename )
+        , m_layout( layout )
+        , m_cells( cells )
+    {
+        m_thread = ::CreateThread( nullptr, 0, &StateSave::run, this, 0, nullptr );
+        RTL_ASSERT( m_thread != nullptr );
+    }
+
+    ~StateSave()
+    {
+        ::WaitForSingleObject( m_thread, INFINITE );
+        ::CloseHandle( m_thread );
+    }
+
+    bool completed() const { return ::WaitForSingleObject( m_thread, 0 ) == WAIT_OBJECT_0; }
+
+private:
+    StateSave( const StateSave& )            = delete;
+    StateSave& operator=( const StateSave& ) = delete;
+
+    static DWORD WINAPI run( LPVOID param )
+    {
+        StateSave* save = static_cast<StateSave*>( param );
+
+        const bool saved
+            = Snapshot::save( save->m_filename.c_str(), save->m_layout, save->m_cells, true );
+
+        return saved ? 0 : 1;
+    }
+
+    rtl::wstring         m_filename;
+    Snapshot::Layout     m_layout;
+    const rtl::uint32_t* m_cells;
+    HANDLE               m_thread { nullptr };
+};
 
 Context::Context( const rtl::opencl::device& device )
     : m_device_name( device.name() )
+    , m_device_hash( hash( device.version(), hash( device.name() ) ) )
 {
     // cppcheck-suppress useInitializationList
     m_context = rtl::opencl::context::create_with_current_ogl_context( device );
 
-    rtl::vector<rtl::uint32_t> state( state_buffer_size, 0 );
+    // NOTE: The keys are followed by the events count and the events
+    rtl::vector<rtl::uint32_t> keys( keys_count + 1 + input_events_max * 2, 0 );
 
-    for ( auto& buffer : m_buffer_state )
-        buffer = m_context.create_buffer_1d_uint( state.size(), state.data() );
+    m_buffer_keys  = m_context.create_buffer_1d_uint( keys.size(), keys.data() );
+    m_buffer_input = m_context.create_buffer_1d_uint( m_input.size() );
+}
 
-    m_buffer_keys = m_context.create_buffer_1d_uint( keys_count );
+Context::~Context()
+{
+    complete_state_save();
 }
 
 void Context::load_program( const wchar_t* filename )
@@ -49,32 +285,360 @@ void Context::load_program( const wchar_t* filename )
 
 void Context::load_program( rtl::string_view source )
 {
-    m_program = m_context.build_program( source );
+    rtl::string program = rtl::string( program_prologue )
+                        + rtl::string( source.data(), source.size() )
+                        + rtl::string( program_epilogue );
+
+    // NOTE: The prologue stands for build options, so it is a part of the key as well
+    const rtl::uint64_t program_hash = hash( program, m_device_hash );
+
+    if ( m_build )
+    {
+        // NOTE: The running build can't be cancelled, and waiting for it would stall the frame,
+        // so the latest program is queued and built after it. The running build is discarded.
+        if ( program_hash == m_build->hash() )
+        {
+            m_queued_program_hash = 0;
+            return;
+        }
+
+        m_queued_program      = rtl::move( program );
+        m_queued_program_hash = program_hash;
+        return;
+    }
+
+    if ( program_hash == m_program_hash )
+        return;
+
+    m_build = rtl::make_unique<ProgramBuild>( m_context, rtl::move( program ), program_hash );
 
-    m_kernel_input     = m_program.create_kernel( "main_input" );
-    m_kernel_video_out = m_program.create_kernel( "main_video_out" );
-    m_kernel_audio_out = m_program.create_kernel( "main_audio_out" );
+    // NOTE: Nothing runs on the state yet, so it gets the layout of the program right away and
+    // the state loaded meanwhile is not remapped on switch
+    if ( !program_loaded() )
+    {
+        set_state_screen_grid( m_build->state_screen_grid );
+        m_video_screen_size = m_build->video_screen_size;
+    }
+}
+
+
+bool Context::program_loading() const
+{
+    return static_cast<bool>( m_build );
+}
+
+rtl::chrono::microseconds Context::program_loading_time() const
+{
+    return m_build ? m_build->elapsed() : rtl::chrono::microseconds::zero();
 }
 
-void Context::init( [[maybe_unused]] const rtl::Application::Input& input, unsigned gl_texture )
+void Context::switch_program()
 {
-    m_audio_data_left.resize( input.audio.samples_per_frame );
-    m_audio_data_right.resize( input.audio.samples_per_frame );
+    if ( !m_build || !m_build->completed() )
+        return;
+
+    if ( m_queued_program_hash != 0 )
+    {
+        m_build.reset();
+        m_program_failed = false;
+
+        // NOTE: The queued program may be the running one, if the user has reverted the changes
+        if ( m_queued_program_hash != m_program_hash )
+            m_build = rtl::make_unique<ProgramBuild>(
+                m_context, rtl::move( m_queued_program ), m_queued_program_hash );
+
+        m_queued_program_hash = 0;
+        return;
+    }
+
+    // NOTE: The previous program keeps running, so the user can fix the source and reload
+    m_program_failed = !m_build->succeeded();
+
+    if ( m_program_failed )
+    {
+        m_build.reset();
+        return;
+    }
+
+    // NOTE: Frames in flight keep the previous kernels alive until they are completed
+    m_program             = rtl::move( m_build->program );
+    m_kernel_input        = rtl::move( m_build->kernel_input );
+    m_kernel_input_unpack = rtl::move( m_build->kernel_input_unpack );
+    m_kernel_audio_format = rtl::move( m_build->kernel_audio_format );
+    m_program_hash        = m_build->hash();
+    m_state_carry         = m_build->state_carry;
+    m_video_screen_size   = m_build->video_screen_size;
+
+    set_state_screen_grid( m_build->state_screen_grid );
+
+    m_build.reset();
+
+    bind_kernels();
+}
+
+void Context::bind_kernels()
+{
+    // NOTE: Nothing to bind until both the program and the buffers are ready
+    if ( m_program_hash == 0 || m_frames.empty() )
+        return;
+
+    bind_video_kernels();
+
+    // NOTE: Kernel arguments persist between launches, so a kernel is created for every
+    // combination of the buffers it is launched with. Only \main_input is bound per frame.
+    for ( size_t i = 0; i < m_buffer_state.size(); ++i )
+    {
+        m_kernel_audio_out[i] = m_program.create_kernel( "main_audio_out" );
+        m_kernel_audio_out[i]
+            .args()
+            .arg( m_buffer_state[i] )
+            .arg( m_buffer_state[i].length() )
+            .arg( m_buffer_audio_left )
+            .arg( m_buffer_audio_right )
+            .arg( m_audio_samples_per_frame )
+            .arg( m_audio_samples_per_second );
+    }
+
+    m_kernel_audio_format.args()
+        .arg( m_buffer_audio_left )
+        .arg( m_buffer_audio_right )
+        .arg( m_buffer_audio );
+
+    m_kernel_input_unpack.args().arg( m_buffer_input ).arg( m_buffer_keys );
+}
+
+void Context::bind_video_kernels()
+{
+    if ( m_program_hash == 0 || m_frames.empty() )
+        return;
+
+    for ( size_t i = 0; i < m_buffer_state.size(); ++i )
+    {
+        for ( Frame& frame : m_frames )
+        {
+            frame.kernel_video_out[i] = m_program.create_kernel( "main_video_out" );
+
+            // NOTE: Arguments are set in order, so the optional ones go to the same binder
+            auto&& args = frame.kernel_video_out[i].args();
+
+            args.arg( m_buffer_state[i] ).arg( m_buffer_state[i].length() ).arg( frame.video );
+
+            if ( m_video_screen_size )
+                args.arg( m_screen_width ).arg( m_screen_height );
+        }
+    }
+}
+
+void Context::init( const rtl::Application::Input& input,
+                    const rtl::vector<unsigned>&   gl_textures,
+                    int                            video_width,
+                    int                            video_height )
+{
+    // NOTE: Frames in flight refer to the buffers, which are going to be recreated
+    m_context.wait();
+
+    m_screen_width  = input.screen.width;
+    m_screen_height = input.screen.height;
+
+    update_state_layout();
 
     m_buffer_audio_left  = m_context.create_buffer_1d_float( input.audio.samples_per_frame );
     m_buffer_audio_right = m_context.create_buffer_1d_float( input.audio.samples_per_frame );
+    m_buffer_audio       = m_context.create_buffer_1d_uint( input.audio.samples_per_frame );
+
+    m_frames.resize( gl_textures.size() );
+
+    for ( size_t i = 0; i < m_frames.size(); ++i )
+    {
+        Frame& frame = m_frames[i];
+
+        frame.audio.resize( input.audio.samples_per_frame );
+        frame.video   = m_context.create_buffer_2d_from_ogl_texture( gl_textures[i] );
+        frame.pending = false;
+    }
+
+    m_frame_index           = 0;
+    m_completed_frame_index = 0;
+
+    m_video_width  = video_width;
+    m_video_height = video_height;
+
+    m_audio_samples_per_frame  = static_cast<unsigned>( input.audio.samples_per_frame );
+    m_audio_samples_per_second = static_cast<unsigned>( input.audio.samples_per_second );
+
+    bind_kernels();
+}
+
+void Context::resize_video( const rtl::vector<unsigned>& gl_textures,
+                            int                          video_width,
+                            int                          video_height )
+{
+    RTL_ASSERT( gl_textures.size() == m_frames.size() );
+
+    // NOTE: Frames in flight write to the previous textures
+    m_context.wait();
+
+    for ( size_t i = 0; i < m_frames.size(); ++i )
+        m_frames[i].video = m_context.create_buffer_2d_from_ogl_texture( gl_textures[i] );
+
+    m_video_width  = video_width;
+    m_video_height = video_height;
+
+    bind_video_kernels();
 
-    m_buffer_video = m_context.create_buffer_2d_from_ogl_texture( gl_texture );
+    // NOTE: The pending frame was rendered to the previous texture, so its image is rendered
+    // again from the state of that frame. The next update presents a black frame otherwise.
+    for ( Frame& frame : m_frames )
+    {
+        if ( !frame.pending || m_program_hash == 0 )
+            continue;
+
+        m_context.enqueue_acquire_ogl_object( frame.video );
+        m_context.enqueue_process_2d( frame.kernel_video_out[1u - m_buffer_state_output_index],
+                                      static_cast<size_t>( m_video_width ),
+                                      static_cast<size_t>( m_video_height ) );
+        m_context.enqueue_release_ogl_object( frame.video );
+    }
+}
+
+void Context::wait()
+{
+    m_context.wait();
+}
+
+// NOTE: Must match CLAPP_STATE_GRID_SIZE of the program prologue
+Snapshot::Layout Context::state_layout( int screen_width, int screen_height )
+{
+    Snapshot::Layout layout;
+    layout.grid_width  = static_cast<rtl::uint32_t>( ( screen_width + state_cell_size - 1 )
+                                                    / state_cell_size );
+    layout.grid_height = static_cast<rtl::uint32_t>( ( screen_height + state_cell_size - 1 )
+                                                     / state_cell_size );
+    return layout;
+}
+
+void Context::set_state_screen_grid( bool enable )
+{
+    m_state_screen_grid = enable;
+
+    update_state_layout();
+}
+
+void Context::update_state_layout()
+{
+    // NOTE: The state is allocated on \init only
+    if ( m_screen_width == 0 )
+        return;
+
+    const Snapshot::Layout layout
+        = m_state_screen_grid
+            ? state_layout( m_screen_width, m_screen_height )
+            : state_layout( fixed_state_screen_width, fixed_state_screen_height );
+
+    if ( layout != m_state_layout )
+        resize_state( layout );
+}
+
+void Context::resize_state( const Snapshot::Layout& layout )
+{
+    complete_state_save();
+
+    rtl::vector<rtl::uint32_t> state( layout.cells_count(), 0 );
+
+    // NOTE: The state survives the window resize
+    if ( !m_state_staging.empty() )
+    {
+        rtl::opencl::buffer& buffer = m_buffer_state[1 - m_buffer_state_output_index];
+
+        m_context.enqueue_copy( buffer, m_state_staging.data(), buffer.length() );
+        m_context.wait();
+
+        Snapshot::remap( m_state_layout, m_state_staging.data(), layout, state.data() );
+    }
+
+    m_state_staging = rtl::move( state );
+    m_state_layout  = layout;
+
+    for ( auto& buffer : m_buffer_state )
+        buffer = m_context.create_buffer_1d_uint( m_state_staging.size(), m_state_staging.data() );
 }
 
 void Context::update( [[maybe_unused]] const rtl::Application::Input& input,
                       [[maybe_unused]] rtl::Application::Output&      output )
 {
-    m_context.enqueue_copy( input.keys.state, m_buffer_keys, m_buffer_keys.length() );
+    switch_program();
+
+    // NOTE: Nothing to run until the first program build completes, so play silence meanwhile
+    if ( m_program_hash == 0 )
+    {
+        complete_frame( input, m_frames[m_frame_index] );
+        return;
+    }
+
+    if ( m_frames.size() == 1 )
+    {
+        // NOTE: The device writes the audio samples straight into the output frame
+        enqueue_frame(
+            input,
+            m_frames[0],
+            reinterpret_cast<rtl::uint32_t*>( input.audio.output_frame_pointer ) );
+        m_context.wait();
+    }
+    else
+    {
+        // NOTE: The queue is in-order, so waiting here completes the frame enqueued by the
+        // previous update only. The device processes the current frame while the host presents
+        // that one.
+        m_context.wait();
+
+        const unsigned frames_count          = static_cast<unsigned>( m_frames.size() );
+        const unsigned completed_frame_index = ( m_frame_index + frames_count - 1 ) % frames_count;
+
+        Frame& frame = m_frames[m_frame_index];
+
+        complete_frame( input, m_frames[completed_frame_index] );
+        enqueue_frame( input, frame, frame.audio.data() );
+
+        frame.pending = true;
+
+        m_completed_frame_index = completed_frame_index;
+        m_frame_index           = ( m_frame_index + 1 ) % frames_count;
+    }
+
+    update_state_save();
+}
+
+void Context::enqueue_frame( const rtl::Application::Input& input,
+                             Frame&                         frame,
+                             rtl::uint32_t*                 audio_samples )
+{
+    if ( m_profiling )
+    {
+        // NOTE: Stage timings must not include the previous work of the device
+        m_context.wait();
+        m_stage_start = rtl::chrono::steady_clock::now();
+    }
 
-    // TODO: remove; do copying of unchanged cells inside kernels
-    m_context.enqueue_copy( m_buffer_state[1u - m_buffer_state_output_index],
-                            m_buffer_state[m_buffer_state_output_index] );
+    // NOTE: Input is sampled right before \main_input, uploaded only if changed
+    const size_t input_size = pack_input( input );
+
+    if ( input_size != 0 )
+    {
+        m_context.enqueue_copy( m_input.data(), m_buffer_input, input_size );
+        m_context.enqueue_process_1d( m_kernel_input_unpack, m_buffer_keys.length() );
+    }
+
+    profile( Stage::keys_upload, input_size * sizeof( rtl::uint32_t ) );
+
+    if ( !m_state_carry )
+    {
+        m_context.enqueue_copy( m_buffer_state[1u - m_buffer_state_output_index],
+                                m_buffer_state[m_buffer_state_output_index] );
+        // NOTE: Copying reads and writes every cell
+        profile( Stage::state_copy,
+                 m_buffer_state[m_buffer_state_output_index].length() * sizeof( rtl::uint32_t )
+                     * 2 );
+    }
 
     m_kernel_input.args()
         .arg( m_buffer_state[1u - m_buffer_state_output_index] ) // current state
@@ -92,104 +656,162 @@ void Context::update( [[maybe_unused]] const rtl::Application::Input& input,
         .arg( 0.5f )
 
         .arg( m_buffer_keys )
-        .arg( m_buffer_keys.length() );
+        .arg( keys_count );
 
     m_context.enqueue_process_1d( m_kernel_input,
                                   m_buffer_state[m_buffer_state_output_index].length() );
-    m_context.wait();
+    profile( Stage::input );
+
+    m_context.enqueue_acquire_ogl_object( frame.video );
+    profile( Stage::video_acquire );
+    m_context.enqueue_process_2d( frame.kernel_video_out[m_buffer_state_output_index],
+                                  static_cast<size_t>( m_video_width ),
+                                  static_cast<size_t>( m_video_height ) );
+    profile( Stage::video_out );
+    m_context.enqueue_release_ogl_object( frame.video );
+    profile( Stage::video_release );
+
+    m_context.enqueue_process_1d( m_kernel_audio_out[m_buffer_state_output_index],
+                                  input.audio.samples_per_frame );
+    profile( Stage::audio_out );
+
+    m_context.enqueue_process_1d( m_kernel_audio_format, input.audio.samples_per_frame );
+    profile( Stage::audio_format );
+    m_context.enqueue_copy( m_buffer_audio, audio_samples, input.audio.samples_per_frame );
+    profile( Stage::audio_readback, input.audio.samples_per_frame * sizeof( rtl::uint32_t ) );
 
-    m_kernel_video_out.args()
-        .arg( m_buffer_state[m_buffer_state_output_index] )
-        .arg( m_buffer_state[m_buffer_state_output_index].length() )
-        .arg( m_buffer_video );
+    m_buffer_state_output_index = 1u - m_buffer_state_output_index;
+    m_audio_samples_generated += input.audio.samples_per_frame;
+}
 
-    m_context.enqueue_acquire_ogl_object( m_buffer_video );
-    m_context.enqueue_process_2d( m_kernel_video_out,
-                                  static_cast<size_t>( input.screen.width ),
-                                  static_cast<size_t>( input.screen.height ) );
-    m_context.enqueue_release_ogl_object( m_buffer_video );
+size_t Context::pack_input( const rtl::Application::Input& input )
+{
+    constexpr size_t words_count = keys_count / 32;
 
-    m_kernel_audio_out.args()
-        .arg( m_buffer_state[m_buffer_state_output_index] )
-        .arg( m_buffer_state[m_buffer_state_output_index].length() )
-        .arg( m_buffer_audio_left )
-        .arg( m_buffer_audio_right )
-        .arg( input.audio.samples_per_frame )
-        .arg( input.audio.samples_per_second );
+    rtl::uint32_t* packed       = m_input.data();
+    rtl::uint32_t& events_count = m_input[words_count];
+    rtl::uint32_t* events       = m_input.data() + words_count + 1;
 
-    m_context.enqueue_process_1d( m_kernel_audio_out, input.audio.samples_per_frame );
-    m_context.enqueue_copy( m_buffer_audio_left,
-                            m_audio_data_left.data(),
-                            input.audio.samples_per_frame );
-    m_context.enqueue_copy( m_buffer_audio_right,
-                            m_audio_data_right.data(),
-                            input.audio.samples_per_frame );
+    const bool events_pending = events_count != 0;
 
-    m_buffer_state_output_index = 1u - m_buffer_state_output_index;
+    events_count = 0;
 
-    m_context.wait();
+    for ( size_t word = 0; word < words_count; ++word )
+    {
+        rtl::uint32_t bits = 0;
 
-    // TODO: convert sample format inside audio kernel
-    constexpr float max_int16 = (float)rtl::numeric_limits<rtl::int16_t>::max();
+        for ( rtl::uint32_t bit = 0; bit < 32; ++bit )
+        {
+            const rtl::uint32_t key     = static_cast<rtl::uint32_t>( word * 32 ) + bit;
+            const bool          pressed = input.keys.state[key] != 0;
+            const bool          was     = ( packed[word] >> bit & 1 ) != 0;
 
-    rtl::int16_t* samples = input.audio.output_frame_pointer;
+            if ( pressed )
+                bits |= 1u << bit;
 
-    for ( size_t i = 0; i < input.audio.samples_per_frame; ++i )
-    {
-        *samples++
-            = (rtl::int16_t)rtl::clamp( m_audio_data_left[i] * max_int16, -max_int16, max_int16 );
-        *samples++
-            = (rtl::int16_t)rtl::clamp( m_audio_data_right[i] * max_int16, -max_int16, max_int16 );
+            // NOTE: The events beyond the limit are dropped, the key states are exact anyway
+            if ( pressed != was && events_count < input_events_max )
+            {
+                const rtl::uint32_t time = static_cast<rtl::uint32_t>( m_audio_samples_generated );
+
+                events[events_count * 2]     = key | ( pressed ? input_event_pressed : 0 );
+                events[events_count * 2 + 1] = time;
+                ++events_count;
+            }
+        }
+
+        packed[word] = bits;
     }
 
-    m_audio_samples_generated += input.audio.samples_per_frame;
+    // NOTE: The events of the previous frame are cleared by the upload as well
+    if ( events_count == 0 && !events_pending && !m_input_dirty )
+        return 0;
+
+    m_input_dirty = false;
+
+    return words_count + 1 + events_count * 2;
 }
 
-bool Context::save_state( const wchar_t* filename )
+void Context::set_profiling( bool enable )
 {
-    rtl::opencl::buffer& buffer = m_buffer_state[1 - m_buffer_state_output_index];
+    m_profiling = enable;
+}
+
+float Context::stage_time( Stage stage ) const
+{
+    return m_stage_times[static_cast<size_t>( stage )];
+}
+
+float Context::stage_bandwidth( Stage stage ) const
+{
+    const size_t index = static_cast<size_t>( stage );
+
+    if ( m_stage_times[index] <= 0.f )
+        return 0.f;
+
+    // NOTE: Bytes per microsecond are megabytes per second
+    return static_cast<float>( m_stage_bytes[index] ) / m_stage_times[index] / 1000.f;
+}
+
+void Context::profile( Stage stage, size_t bytes )
+{
+    if ( !m_profiling )
+        return;
 
-    rtl::vector<rtl::uint32_t> state( buffer.length(), 0 );
-    m_context.enqueue_copy( buffer, state.data(), buffer.length() );
     m_context.wait();
 
-    // TODO: save to tmp file, than rename
-    auto f
-        = fs::file::open( filename, fs::file::access::write_only, fs::file::mode::create_always );
-    if ( !f )
-        return false;
+    const auto                      now     = rtl::chrono::steady_clock::now();
+    const rtl::chrono::microseconds elapsed = now - m_stage_start;
+
+    m_stage_start = now;
 
-    const unsigned bytes_to_write = state.size() * sizeof( rtl::uint32_t );
+    // NOTE: Exponential moving average over about 16 frames
+    float& average = m_stage_times[static_cast<size_t>( stage )];
+    average += ( static_cast<float>( elapsed.count() ) - average ) / 16.f;
 
-    return f.write( state.data(), bytes_to_write ) == bytes_to_write;
+    m_stage_bytes[static_cast<size_t>( stage )] = bytes;
 }
 
-bool Context::load_state( const wchar_t* filename )
+void Context::complete_frame( const rtl::Application::Input& input, Frame& frame )
 {
-    auto f = fs::file::open( filename, fs::file::access::read_only, fs::file::mode::open_existing );
-    if ( !f )
-        return false;
+    rtl::uint32_t* samples = reinterpret_cast<rtl::uint32_t*>( input.audio.output_frame_pointer );
 
-    f.seek( 0, fs::file::position::end );
+    // NOTE: There is no completed frame yet right after initialization in pipelined mode
+    for ( size_t i = 0; i < input.audio.samples_per_frame; ++i )
+        samples[i] = frame.pending ? frame.audio[i] : 0;
 
-    const size_t cells_count = static_cast<size_t>( f.tell() ) / sizeof( rtl::uint32_t );
+    frame.pending = false;
+}
 
-    // TODO: check using version number and notify user if mismatch detected
-    if ( cells_count != state_buffer_size )
+bool Context::save_state( const wchar_t* filename )
+{
+    // NOTE: The state is allocated on \init only
+    if ( m_state_staging.empty() )
         return false;
 
-    rtl::vector<rtl::uint32_t> state( cells_count, 0 );
+    complete_state_save();
 
-    f.seek( 0, fs::file::position::begin );
+    rtl::opencl::buffer& buffer = m_buffer_state[1 - m_buffer_state_output_index];
+
+    m_context.enqueue_copy( buffer, m_state_staging.data(), buffer.length() );
+    m_context.wait();
 
-    const unsigned bytes_to_read = cells_count * sizeof( rtl::uint32_t );
+    return Snapshot::save( filename, m_state_layout, m_state_staging.data() );
+}
 
-    if ( f.read( state.data(), bytes_to_read ) != bytes_to_read )
+bool Context::load_state( const wchar_t* filename )
+{
+    if ( m_state_staging.empty() )
+        return false;
+
+    complete_state_save();
+
+    if ( !Snapshot::load( filename, m_state_layout, m_state_staging.data() ) )
         return false;
 
     rtl::opencl::buffer& buffer = m_buffer_state[1 - m_buffer_state_output_index];
 
-    m_context.enqueue_copy( state.data(), buffer, buffer.length() );
+    m_context.enqueue_copy( m_state_staging.data(), buffer, buffer.length() );
     m_context.wait();
 
     return true;
@@ -197,10 +819,61 @@ bool Context::load_state( const wchar_t* filename )
 
 void Context::reset_state()
 {
-    rtl::vector<rtl::uint32_t> state( state_buffer_size, 0 );
+    complete_state_save();
+
+    for ( auto& cell : m_state_staging )
+        cell = 0;
 
     rtl::opencl::buffer& buffer = m_buffer_state[1 - m_buffer_state_output_index];
 
-    m_context.enqueue_copy( state.data(), buffer, buffer.length() );
+    m_context.enqueue_copy( m_state_staging.data(), buffer, buffer.length() );
     m_context.wait();
 }
+
+bool Context::save_state_async( const wchar_t* filename )
+{
+    // NOTE: There is no state to save until the first program build completes
+    if ( m_state_staging.empty() || !program_loaded() || state_saving() )
+        return false;
+
+    rtl::opencl::buffer& buffer = m_buffer_state[1 - m_buffer_state_output_index];
+
+    // NOTE: The queue is in-order, so the state is read back before the next frame changes it.
+    // The transfer is completed by the wait of the next update.
+    m_context.enqueue_copy( buffer, m_state_staging.data(), buffer.length() );
+
+    m_state_save_filename = filename;
+    m_state_save_readback = true;
+
+    return true;
+}
+
+bool Context::state_saving() const
+{
+    return m_state_save_readback || static_cast<bool>( m_state_save );
+}
+
+void Context::update_state_save()
+{
+    if ( m_state_save_readback )
+    {
+        m_state_save_readback = false;
+        m_state_save          = rtl::make_unique<StateSave>(
+            m_state_save_filename.c_str(), m_state_layout, m_state_staging.data() );
+    }
+    else if ( m_state_save && m_state_save->completed() )
+    {
+        m_state_save.reset();
+    }
+}
+
+void Context::complete_state_save()
+{
+    if ( m_state_save_readback )
+    {
+        m_context.wait();
+        update_state_save();
+    }
+
+    m_state_save.reset();
+}
@@ -10,7 +10,12 @@
  */
 #pragma once
 
+#include "snapshot.hpp"
+
 #include <rtl/array.hpp>
+#include <rtl/chrono.hpp>
+#include <rtl/memory.hpp>
+#include <rtl/string.hpp>
 #include <rtl/sys/application.hpp>
 #include <rtl/sys/opencl.hpp>
 
@@ -20,45 +25,202 @@ namespace clapp
     {
     public:
         explicit Context( const rtl::opencl::device& device );
-        ~Context() = default;
+        ~Context();
+
+        // NOTE: Each texture holds one video frame in flight. The state grid follows the screen
+        // of \input, the textures may be smaller, if \video_scalable.
+        void init( const rtl::Application::Input& input,
+                   const rtl::vector<unsigned>&   gl_textures,
+                   int                            video_width,
+                   int                            video_height );
+
+        // Waits for the frames in flight, so their textures can be deleted
+        void wait();
 
-        void init( const rtl::Application::Input& input, unsigned gl_texture );
+        // Switches to the textures of another size, the state and the audio are kept. The pending
+        // frame is rendered to its new texture again.
+        void resize_video( const rtl::vector<unsigned>& gl_textures,
+                           int                          video_width,
+                           int                          video_height );
         void update( const rtl::Application::Input& input, rtl::Application::Output& output );
 
+        // NOTE: The program is built in background, the previous one (if any) runs meanwhile
         void load_program( const wchar_t* filename );
         void load_program( rtl::string_view program );
 
+        bool                      program_loading() const;
+        rtl::chrono::microseconds program_loading_time() const;
+        bool                      program_loaded() const { return m_program_hash != 0; }
+
+        // NOTE: Set, if the latest build failed and the previous program (if any) kept running
+        bool program_failed() const { return m_program_failed; }
+
+        // NOTE: Set, if the running program carries the state forward by itself
+        bool state_carry() const { return m_state_carry; }
+
+        // NOTE: Set, if the program maps the pixels to the screen by itself, so its video may be
+        // rendered at a lower resolution than the screen
+        bool video_scalable() const { return m_video_screen_size; }
+
+        // Switches to the program built in background as soon as it is ready
+        void switch_program();
+
         bool save_state( const wchar_t* filename );
         bool load_state( const wchar_t* filename );
         void reset_state();
 
+        // NOTE: The state is read back along with the next frame and written on a background
+        // thread. Fails if the previous background save is still running.
+        bool save_state_async( const wchar_t* filename );
+        bool state_saving() const;
+
         const rtl::string& opencl_device_name() const { return m_device_name; }
 
+        // Index of the texture, that holds the latest completed video frame
+        unsigned video_frame_index() const { return m_completed_frame_index; }
+
+        enum class Stage
+        {
+            keys_upload,
+            state_copy,
+            input,
+            video_acquire,
+            video_out,
+            video_release,
+            audio_out,
+            audio_format,
+            audio_readback,
+            count
+        };
+
+        // NOTE: Profiling waits for the device after every stage, so frames in flight don't
+        // overlap while it is enabled
+        void set_profiling( bool enable );
+
+        // Average stage time in microseconds
+        float stage_time( Stage stage ) const;
+
+        // Average stage throughput in gigabytes per second, zero for stages without transfers
+        float stage_bandwidth( Stage stage ) const;
+
     private:
-        static constexpr size_t keys_count = 256;
+        class ProgramBuild;
+        class StateSave;
+
+        struct Frame
+        {
+            rtl::opencl::buffer        video;
+            rtl::vector<rtl::uint32_t> audio; // interleaved 16-bit stereo samples
+            bool                       pending { false };
+
+            // NOTE: Bound to the video buffer and the state buffer of each parity
+            rtl::array<rtl::opencl::kernel, 2> kernel_video_out;
+        };
+
+        void enqueue_frame( const rtl::Application::Input& input,
+                            Frame&                         frame,
+                            rtl::uint32_t*                 audio_samples );
+        void complete_frame( const rtl::Application::Input& input, Frame& frame );
+        void profile( Stage stage, size_t bytes = 0 );
+
+        // Packs the key states and the events into \m_input, returns the count of words to
+        // upload or zero if nothing has changed
+        size_t pack_input( const rtl::Application::Input& input );
+
+        static constexpr size_t keys_count       = 256;
+        static constexpr size_t input_events_max = 32;
 
-        // TODO: Use common (with OpenCL program) constants definitions
-        static constexpr size_t state_buffer_size
-            = ( 7680 / 4 ) * ( 4320 / 4 ) + 256 * 256 + 256 * 256;
+        // NOTE: Every cell of the state grid covers the square of screen pixels
+        static constexpr int state_cell_size = 4;
+
+        static Snapshot::Layout state_layout( int screen_width, int screen_height );
+
+        // NOTE: The state is sized for the screen only for the programs, which declare it
+        void set_state_screen_grid( bool enable );
+        void update_state_layout();
+
+        // NOTE: The current state is remapped to the new layout
+        void resize_state( const Snapshot::Layout& layout );
+
+        // Binds the arguments, which don't change between frames
+        void bind_kernels();
+        void bind_video_kernels();
+
+        // Starts writing the state as soon as it is read back
+        void update_state_save();
+
+        // NOTE: Blocking state operations reuse the staging buffer, so they complete the
+        // background save first
+        void complete_state_save();
 
         rtl::string          m_device_name;
+        // NOTE: Skips the rebuild of the running program only, nothing is cached across runs
+        rtl::uint64_t        m_device_hash { 0 };
+        rtl::uint64_t        m_program_hash { 0 };
         rtl::opencl::context m_context;
         rtl::opencl::program m_program;
 
         rtl::opencl::kernel m_kernel_input;
-        rtl::opencl::kernel m_kernel_audio_out;
-        rtl::opencl::kernel m_kernel_video_out;
+        rtl::opencl::kernel m_kernel_input_unpack;
+        rtl::opencl::kernel m_kernel_audio_format;
+
+        // NOTE: Bound to the state buffer of each parity
+        rtl::array<rtl::opencl::kernel, 2> m_kernel_audio_out;
 
         rtl::array<rtl::opencl::buffer, 2> m_buffer_state;
         size_t                             m_buffer_state_output_index { 0 };
 
+        Snapshot::Layout m_state_layout;
+        bool             m_state_screen_grid { false };
+        int              m_screen_width { 0 };
+        int              m_screen_height { 0 };
+
+        // NOTE: Host side of the state transfers, allocated once to keep save/load allocation-free
+        rtl::vector<rtl::uint32_t> m_state_staging;
+
+        rtl::wstring m_state_save_filename;
+        bool         m_state_save_readback { false };
+
+        // NOTE: Refers to \m_state_staging, so it must be destroyed first
+        rtl::unique_ptr<StateSave> m_state_save;
+
         rtl::opencl::buffer m_buffer_keys;
+        rtl::opencl::buffer m_buffer_input;
+
+        // NOTE: Bit-packed key states, the events count and the events
+        rtl::array<rtl::uint32_t, keys_count / 32 + 1 + input_events_max * 2> m_input {};
+        bool m_input_dirty { true };
+
         rtl::opencl::buffer m_buffer_audio_left;
         rtl::opencl::buffer m_buffer_audio_right;
-        rtl::opencl::buffer m_buffer_video;
+        rtl::opencl::buffer m_buffer_audio;
+
+        rtl::vector<Frame> m_frames;
+        unsigned           m_frame_index { 0 };
+        unsigned           m_completed_frame_index { 0 };
+        int                m_video_width { 0 };
+        int                m_video_height { 0 };
+
+        int      m_audio_samples_generated { 0 };
+        unsigned m_audio_samples_per_frame { 0 };
+        unsigned m_audio_samples_per_second { 0 };
+
+        static constexpr size_t stages_count = static_cast<size_t>( Stage::count );
+
+        bool                                  m_profiling { false };
+        rtl::chrono::steady_clock::time_point m_stage_start;
+        rtl::array<float, stages_count>       m_stage_times {};
+        rtl::array<size_t, stages_count>      m_stage_bytes {};
+
+        // NOTE: Refers to \m_context, so it must be destroyed first
+        rtl::unique_ptr<ProgramBuild> m_build;
+
+        bool m_program_failed { false };
+        bool m_state_carry { false };
+        bool m_video_screen_size { false };
 
-        rtl::vector<float> m_audio_data_left;
-        rtl::vector<float> m_audio_data_right;
-        int                m_audio_samples_generated { 0 };
+        // NOTE: The program loaded while \m_build is running, zero hash if none
+        rtl::string   m_queued_program;
+        rtl::uint64_t m_queued_program_hash { 0 };
     };
 }
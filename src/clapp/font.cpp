@@ -10,6 +10,8 @@
  */
 #include "font.hpp"
 
+#include <rtl/sys/debug.hpp>
+
 #pragma warning( push )
 #pragma warning( disable : 4668 )
 #define NOMINMAX
@@ -24,16 +26,25 @@ using namespace clapp;
 
 namespace
 {
-    // TODO: Add Unicode support
-    // constexpr size_t glyph_count = 65536;
-    constexpr size_t glyph_count = 256;
+    // NOTE: Enough for thousands of glyphs of the HUD font size
+    constexpr int atlas_size = 1024;
+
+    // NOTE: Keeps the neighbouring glyphs apart
+    constexpr int glyph_padding = 1;
+
+    // NOTE: Magenta in the RGBA byte order of the vertex color
+    constexpr rtl::uint32_t text_color = 0x00ff00ff;
+
+    // NOTE: GGO_GRAY8_BITMAP has 65 levels of gray
+    constexpr unsigned gray_levels = 64;
+
+    constexpr MAT2 identity { { 0, 1 }, { 0, 0 }, { 0, 0 }, { 0, 1 } };
 }
 
 Font::Font( int size )
     : m_font_size( size )
 {
-    HDC hdc = ::wglGetCurrentDC();
-
+    // NOTE: GetGlyphOutline fails for raster fonts, so the mapper is restricted to TrueType ones
     HFONT font = ::CreateFontW( m_font_size,
                                 0,
                                 0,
@@ -43,33 +54,216 @@ Font::Font( int size )
                                 FALSE,
                                 FALSE,
                                 DEFAULT_CHARSET,
-                                OUT_DEFAULT_PRECIS,
+                                OUT_TT_ONLY_PRECIS,
                                 CLIP_DEFAULT_PRECIS,
                                 DEFAULT_QUALITY,
                                 DEFAULT_PITCH | FF_DONTCARE,
                                 nullptr );
 
-    ::SelectObject( hdc, font );
+    // NOTE: Glyphs are rasterized on demand, so the font stays selected in the memory DC
+    HDC dc = ::CreateCompatibleDC( nullptr );
+    ::SelectObject( dc, font );
+
+    m_font = font;
+    m_dc   = dc;
+
+    ::glGenTextures( 1, &m_atlas );
+    ::glBindTexture( GL_TEXTURE_2D, m_atlas );
+    ::glTexImage2D( GL_TEXTURE_2D,
+                    0,
+                    GL_ALPHA8,
+                    atlas_size,
+                    atlas_size,
+                    0,
+                    GL_ALPHA,
+                    GL_UNSIGNED_BYTE,
+                    nullptr );
+
+    // NOTE: Glyphs are drawn at whole pixels without scaling
+    ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    ::glBindTexture( GL_TEXTURE_2D, 0 );
+}
+
+Font::~Font()
+{
+    ::glDeleteTextures( 1, &m_atlas );
+
+    ::DeleteDC( static_cast<HDC>( m_dc ) );
+    [[maybe_unused]] BOOL result = ::DeleteObject( static_cast<HFONT>( m_font ) );
+}
+
+void Font::add( rtl::wstring_view text, int x, int y, float opacity )
+{
+    if ( opacity <= 0.f || text.empty() )
+        return;
+
+    const float         clamped = opacity < 1.f ? opacity : 1.f;
+    const rtl::uint32_t alpha   = static_cast<rtl::uint32_t>( clamped * 255.f + .5f );
+    const rtl::uint32_t color   = text_color | ( alpha << 24 );
+
+    // NOTE: New glyphs are uploaded to the atlas right away, before the batch is drawn
+    int pen = x;
 
-    m_font_lists = ::glGenLists( glyph_count );
+    for ( wchar_t code : text )
+    {
+        const Glyph& g = glyph( code );
 
-    ::wglUseFontBitmapsA( hdc, 0, glyph_count, m_font_lists );
+        if ( g.width > 0 && g.height > 0 )
+        {
+            const float left   = static_cast<float>( pen + g.left );
+            const float top    = static_cast<float>( y + g.top );
+            const float right  = left + g.width;
+            const float bottom = top - g.height;
 
-    [[maybe_unused]] BOOL result = ::DeleteObject( font );
+            const float u0 = g.u;
+            const float v0 = g.v;
+            const float u1 = g.u + static_cast<float>( g.width ) / atlas_size;
+            const float v1 = g.v + static_cast<float>( g.height ) / atlas_size;
+
+            m_vertices.push_back( { left, top, u0, v0, color } );
+            m_vertices.push_back( { right, top, u1, v0, color } );
+            m_vertices.push_back( { right, bottom, u1, v1, color } );
+            m_vertices.push_back( { left, bottom, u0, v1, color } );
+        }
+
+        pen += g.advance;
+    }
 }
 
-void Font::draw( rtl::wstring_view text, int x, int y, float opacity )
+void Font::draw()
 {
+    if ( m_vertices.empty() )
+        return;
+
     ::glEnable( GL_BLEND );
     ::glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-    ::glColor4f( 1.0f, 0.0f, 1.0f, opacity );
-    ::glRasterPos3i( x, y, 0 );
-    ::glListBase( m_font_lists );
-    ::glCallLists( static_cast<GLsizei>( text.size() ), GL_UNSIGNED_SHORT, text.data() );
+
+    // NOTE: Alpha texture modulates the alpha of the vertex color only
+    ::glEnable( GL_TEXTURE_2D );
+    ::glBindTexture( GL_TEXTURE_2D, m_atlas );
+    ::glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE );
+
+    constexpr GLsizei stride = sizeof( Vertex );
+
+    ::glEnableClientState( GL_VERTEX_ARRAY );
+    ::glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+    ::glEnableClientState( GL_COLOR_ARRAY );
+
+    ::glVertexPointer( 2, GL_FLOAT, stride, &m_vertices[0].x );
+    ::glTexCoordPointer( 2, GL_FLOAT, stride, &m_vertices[0].u );
+    ::glColorPointer( 4, GL_UNSIGNED_BYTE, stride, &m_vertices[0].color );
+
+    ::glDrawArrays( GL_QUADS, 0, static_cast<GLsizei>( m_vertices.size() ) );
+
+    ::glDisableClientState( GL_COLOR_ARRAY );
+    ::glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+    ::glDisableClientState( GL_VERTEX_ARRAY );
+
+    ::glBindTexture( GL_TEXTURE_2D, 0 );
+    ::glDisable( GL_TEXTURE_2D );
     ::glDisable( GL_BLEND );
+
+    // NOTE: Capacity is kept, so the steady state doesn't allocate
+    m_vertices.clear();
 }
 
-Font::~Font()
+const Font::Glyph& Font::glyph( wchar_t code )
 {
-    ::glDeleteLists( m_font_lists, glyph_count );
+    const size_t index = static_cast<size_t>( code );
+
+    rtl::unique_ptr<Page>& page = m_pages[index / page_size];
+
+    if ( !page )
+        page = rtl::make_unique<Page>();
+
+    Glyph& result = ( *page )[index % page_size];
+
+    if ( !result.cached )
+        rasterize( code, result );
+
+    return result;
+}
+
+void Font::rasterize( wchar_t code, Glyph& glyph )
+{
+    glyph.cached = true;
+
+    HDC          dc = static_cast<HDC>( m_dc );
+    GLYPHMETRICS metrics {};
+
+    const DWORD size
+        = ::GetGlyphOutlineW( dc, code, GGO_GRAY8_BITMAP, &metrics, 0, nullptr, &identity );
+
+    RTL_ASSERT( size != GDI_ERROR );
+
+    // NOTE: The glyph is skipped, it has neither a bitmap nor an advance
+    if ( size == GDI_ERROR )
+        return;
+
+    glyph.advance = metrics.gmCellIncX;
+
+    // NOTE: Whitespace has no bitmap
+    if ( size == 0 )
+        return;
+
+    const int width  = static_cast<int>( metrics.gmBlackBoxX );
+    const int height = static_cast<int>( metrics.gmBlackBoxY );
+
+    if ( m_atlas_x + width + glyph_padding > atlas_size )
+    {
+        m_atlas_x = 0;
+        m_atlas_y += m_atlas_row_height + glyph_padding;
+        m_atlas_row_height = 0;
+    }
+
+    // TODO: Evict the glyphs of the least recent strings, when the atlas is full
+    if ( m_atlas_y + height > atlas_size )
+        return;
+
+    m_bitmap.resize( size );
+
+    const DWORD result = ::GetGlyphOutlineW(
+        dc, code, GGO_GRAY8_BITMAP, &metrics, size, m_bitmap.data(), &identity );
+
+    RTL_ASSERT( result != GDI_ERROR );
+
+    if ( result == GDI_ERROR )
+        return;
+
+    // NOTE: Rows of the bitmap are DWORD aligned
+    const int pitch = ( width + 3 ) & ~3;
+
+    for ( int row = 0; row < height; ++row )
+    {
+        rtl::uint8_t* pixels = m_bitmap.data() + row * pitch;
+
+        for ( int column = 0; column < width; ++column )
+            pixels[column] = static_cast<rtl::uint8_t>( pixels[column] * 255 / gray_levels );
+    }
+
+    ::glBindTexture( GL_TEXTURE_2D, m_atlas );
+    ::glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    ::glTexSubImage2D( GL_TEXTURE_2D,
+                       0,
+                       m_atlas_x,
+                       m_atlas_y,
+                       width,
+                       height,
+                       GL_ALPHA,
+                       GL_UNSIGNED_BYTE,
+                       m_bitmap.data() );
+    ::glBindTexture( GL_TEXTURE_2D, 0 );
+
+    glyph.left   = static_cast<short>( metrics.gmptGlyphOrigin.x );
+    glyph.top    = static_cast<short>( metrics.gmptGlyphOrigin.y );
+    glyph.width  = static_cast<short>( width );
+    glyph.height = static_cast<short>( height );
+    glyph.u      = static_cast<float>( m_atlas_x ) / atlas_size;
+    glyph.v      = static_cast<float>( m_atlas_y ) / atlas_size;
+
+    m_atlas_x += width + glyph_padding;
+
+    if ( height > m_atlas_row_height )
+        m_atlas_row_height = height;
 }
@@ -10,22 +10,77 @@
  */
 #pragma once
 
+#include <rtl/array.hpp>
+#include <rtl/memory.hpp>
 #include <rtl/string.hpp>
+#include <rtl/vector.hpp>
 
 namespace clapp
 {
+    // Glyphs are rasterized on the first use into the atlas texture, text is drawn as quads
     class Font final
     {
     public:
         explicit Font( int size );
         ~Font();
 
-        void draw( rtl::wstring_view text, int x, int y, float opacity );
+        // NOTE: The text is queued only, \y is the baseline. Transparent text is skipped.
+        void add( rtl::wstring_view text, int x, int y, float opacity );
+
+        // Draws the queued text with a single draw call
+        void draw();
 
         int size() const { return m_font_size; }
 
     private:
+        Font( const Font& )            = delete;
+        Font& operator=( const Font& ) = delete;
+
+        struct Glyph
+        {
+            bool cached { false };
+
+            // NOTE: Pixel offsets of the bitmap from the pen position on the baseline
+            short left { 0 };
+            short top { 0 };
+            short width { 0 };
+            short height { 0 };
+            short advance { 0 };
+
+            float u { 0.f };
+            float v { 0.f };
+        };
+
+        struct Vertex
+        {
+            float         x;
+            float         y;
+            float         u;
+            float         v;
+            rtl::uint32_t color;
+        };
+
+        static constexpr size_t page_size = 256;
+
+        using Page = rtl::array<Glyph, page_size>;
+
+        const Glyph& glyph( wchar_t code );
+        void         rasterize( wchar_t code, Glyph& glyph );
+
         int      m_font_size { 0 };
-        unsigned m_font_lists { 0 };
+        void*    m_font { nullptr };
+        void*    m_dc { nullptr };
+        unsigned m_atlas { 0 };
+
+        // NOTE: Shelf packing: glyphs are placed left to right in rows of the tallest glyph
+        int m_atlas_x { 0 };
+        int m_atlas_y { 0 };
+        int m_atlas_row_height { 0 };
+
+        // NOTE: Glyph pages cover the whole UCS-2 range and are allocated on demand
+        rtl::array<rtl::unique_ptr<Page>, 65536 / page_size> m_pages;
+
+        rtl::vector<Vertex>       m_vertices;
+        rtl::vector<rtl::uint8_t> m_bitmap;
     };
 }
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#include "frame_meter.hpp"
+
+using namespace clapp;
+
+namespace
+{
+    constexpr unsigned sub_buckets_bits  = 3;
+    constexpr unsigned sub_buckets_count = 1 << sub_buckets_bits;
+
+    // Quantiles of the summary in thousandths
+    constexpr rtl::array<size_t, 4> quantiles { 500, 950, 990, 999 };
+}
+
+void FrameMeter::add( rtl::chrono::microseconds frame_time )
+{
+    const unsigned time = frame_time.count() > 0 ? static_cast<unsigned>( frame_time.count() ) : 0;
+
+    if ( m_count == window_size )
+    {
+        const unsigned oldest = m_frames[m_next];
+
+        --m_buckets[bucket( oldest )];
+        m_sum -= oldest;
+    }
+    else
+    {
+        ++m_count;
+    }
+
+    m_frames[m_next] = time;
+    ++m_buckets[bucket( time )];
+    m_sum += time;
+
+    m_next = ( m_next + 1 ) % window_size;
+}
+
+FrameMeter::Summary FrameMeter::summary() const
+{
+    Summary result;
+
+    if ( m_count == 0 )
+        return result;
+
+    // NOTE: The window is filled from the start, so the first \m_count frames are valid
+    result.min = m_frames[0];
+    result.max = m_frames[0];
+
+    for ( size_t i = 1; i < m_count; ++i )
+    {
+        const unsigned time = m_frames[i];
+
+        if ( time < result.min )
+            result.min = time;
+
+        if ( time > result.max )
+            result.max = time;
+    }
+
+    result.mean = static_cast<unsigned>( m_sum / m_count );
+
+    rtl::array<unsigned, quantiles.size()> values {};
+
+    size_t quantile = 0;
+    size_t frames   = 0;
+
+    for ( size_t i = 0; i < buckets_count && quantile < quantiles.size(); ++i )
+    {
+        frames += m_buckets[i];
+
+        // NOTE: Rank of the quantile frame is rounded up, so p99.9 of a short window is the max
+        while ( quantile < quantiles.size() && frames * 1000 >= m_count * quantiles[quantile] )
+        {
+            unsigned value = bucket_middle( i );
+
+            if ( value < result.min )
+                value = result.min;
+
+            if ( value > result.max )
+                value = result.max;
+
+            values[quantile++] = value;
+        }
+    }
+
+    result.p50  = values[0];
+    result.p95  = values[1];
+    result.p99  = values[2];
+    result.p999 = values[3];
+
+    return result;
+}
+
+unsigned FrameMeter::frame_time( size_t age ) const
+{
+    if ( age >= m_count )
+        return 0;
+
+    return m_frames[( m_next + window_size - 1 - age ) % window_size];
+}
+
+size_t FrameMeter::bucket( unsigned time )
+{
+    if ( time < sub_buckets_count )
+        return time;
+
+    unsigned octave = sub_buckets_bits;
+
+    while ( ( time >> ( octave + 1 ) ) != 0 )
+        ++octave;
+
+    const size_t sub_bucket = ( time >> ( octave - sub_buckets_bits ) ) & ( sub_buckets_count - 1 );
+    const size_t index      = ( octave - sub_buckets_bits + 1 ) * sub_buckets_count + sub_bucket;
+
+    return index < buckets_count ? index : buckets_count - 1;
+}
+
+unsigned FrameMeter::bucket_middle( size_t index )
+{
+    if ( index < sub_buckets_count )
+        return static_cast<unsigned>( index );
+
+    const unsigned shift      = static_cast<unsigned>( index / sub_buckets_count ) - 1;
+    const unsigned sub_bucket = static_cast<unsigned>( index % sub_buckets_count );
+    const unsigned lower      = ( sub_buckets_count + sub_bucket ) << shift;
+
+    return lower + ( ( 1u << shift ) >> 1 );
+}
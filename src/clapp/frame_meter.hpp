@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#pragma once
+
+#include <rtl/array.hpp>
+#include <rtl/chrono.hpp>
+
+namespace clapp
+{
+    // Frame times over the sliding window of the latest frames. Quantiles are taken from the
+    // histogram with logarithmic buckets, so they are accurate within about 6%.
+    class FrameMeter final
+    {
+    public:
+        static constexpr size_t window_size = 1024;
+
+        // NOTE: Frame times in microseconds
+        struct Summary
+        {
+            unsigned min { 0 };
+            unsigned max { 0 };
+            unsigned mean { 0 };
+            unsigned p50 { 0 };
+            unsigned p95 { 0 };
+            unsigned p99 { 0 };
+            unsigned p999 { 0 };
+        };
+
+        void add( rtl::chrono::microseconds frame_time );
+
+        Summary summary() const;
+
+        // Count of frames in the window
+        size_t count() const { return m_count; }
+
+        // Frame time in microseconds, \age is zero for the latest frame
+        unsigned frame_time( size_t age ) const;
+
+    private:
+        // NOTE: Exact buckets below 8 us, then 8 buckets per octave up to a minute
+        static constexpr size_t buckets_count = 192;
+
+        static size_t   bucket( unsigned time );
+        static unsigned bucket_middle( size_t index );
+
+        rtl::array<unsigned, window_size>   m_frames {};
+        rtl::array<unsigned, buckets_count> m_buckets {};
+
+        size_t        m_next { 0 };
+        size_t        m_count { 0 };
+        rtl::uint64_t m_sum { 0 };
+    };
+}
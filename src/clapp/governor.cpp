@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#include "governor.hpp"
+
+#include <rtl/array.hpp>
+
+using namespace clapp;
+
+namespace
+{
+    constexpr rtl::array<float, 10> levels {
+        1.f, .85f, .7f, .6f, .5f, .4f, .35f, .25f, .18f, .125f
+    };
+
+    // NOTE: The thresholds are apart to keep the scale from oscillating between two levels
+    constexpr float over_budget  = .9f;
+    constexpr float under_budget = .7f;
+
+    constexpr unsigned frames_to_scale_down = 30;
+    constexpr unsigned frames_to_scale_up   = 180;
+
+    // NOTE: The scale change reallocates the textures and renders the pending frame again, so the
+    // next frames are slow regardless of the scale
+    constexpr unsigned frames_to_settle = 30;
+
+    constexpr unsigned default_framerate = 60;
+}
+
+Governor::Governor( unsigned display_framerate )
+    : m_budget( 1000000 / ( display_framerate != 0 ? display_framerate : default_framerate ) )
+    // TODO: Take from resources
+    , m_reason( L"initial" )
+{
+}
+
+bool Governor::update( rtl::chrono::microseconds render_time )
+{
+    const float time = static_cast<float>( render_time.count() );
+
+    if ( m_frames_to_skip > 0 )
+    {
+        --m_frames_to_skip;
+        m_average = time;
+        return false;
+    }
+
+    // NOTE: Exponential moving average over about 16 frames
+    m_average += ( time - m_average ) / 16.f;
+
+    const float budget = static_cast<float>( m_budget.count() );
+
+    // NOTE: The render time is assumed to be proportional to the pixels count
+    float scaled_up_time = m_average;
+
+    if ( m_level > 0 )
+    {
+        const float ratio = levels[m_level - 1] / levels[m_level];
+        scaled_up_time *= ratio * ratio;
+    }
+
+    m_frames_over  = m_average > budget * over_budget ? m_frames_over + 1 : 0;
+    m_frames_under = m_level > 0 && scaled_up_time < budget * under_budget ? m_frames_under + 1
+                                                                           : 0;
+
+    if ( m_frames_over >= frames_to_scale_down && m_level + 1 < levels.size() )
+    {
+        ++m_level;
+        // TODO: Take from resources
+        m_reason = L"over budget";
+    }
+    else if ( m_frames_under >= frames_to_scale_up )
+    {
+        --m_level;
+        // TODO: Take from resources
+        m_reason = L"headroom";
+    }
+    else
+    {
+        return false;
+    }
+
+    m_frames_over    = 0;
+    m_frames_under   = 0;
+    m_frames_to_skip = frames_to_settle;
+
+    return true;
+}
+
+float Governor::scale() const
+{
+    return levels[m_level];
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#pragma once
+
+#include <rtl/chrono.hpp>
+
+namespace clapp
+{
+    // Picks the render scale, that keeps the render time within the display frame period
+    class Governor final
+    {
+    public:
+        explicit Governor( unsigned display_framerate );
+
+        // NOTE: \render_time is the host time spent on the frame, excluding the VSYNC wait.
+        // Returns true, if the render scale has changed.
+        bool update( rtl::chrono::microseconds render_time );
+
+        // Video to screen resolution ratio
+        float scale() const;
+
+        // Reason of the latest scale change
+        const wchar_t* reason() const { return m_reason; }
+
+    private:
+        rtl::chrono::microseconds m_budget;
+
+        unsigned       m_level { 0 };
+        unsigned       m_frames_over { 0 };
+        unsigned       m_frames_under { 0 };
+        unsigned       m_frames_to_skip { 0 };
+        float          m_average { 0.f };
+        const wchar_t* m_reason;
+    };
+}
@@ -10,6 +10,14 @@
  */
 #include "hud.hpp"
 #include "font.hpp"
+#include "frame_meter.hpp"
+
+#pragma warning( push )
+#pragma warning( disable : 4668 )
+#define NOMINMAX
+#include <Windows.h>
+#include <gl/GL.h>
+#pragma warning( pop )
 
 namespace timings
 {
@@ -17,10 +25,19 @@ namespace timings
     constexpr rtl::chrono::milliseconds exposition { 3000 };
 }
 
+namespace graph
+{
+    constexpr size_t frames_count = 256;
+
+    // NOTE: The median frame time is in the middle of the graph, spikes are clipped at the top
+    constexpr float median_level = .5f;
+}
+
 using namespace clapp;
 
-void Hud::init( int /* screen_width */, int screen_height )
+void Hud::init( int screen_width, int screen_height )
 {
+    m_screen_width  = screen_width;
     m_screen_height = screen_height;
 }
 
@@ -29,6 +46,11 @@ void Hud::set_status( rtl::wstring_view text )
     m_status.animate_text( text );
 }
 
+void Hud::set_progress( rtl::wstring_view text )
+{
+    m_progress.set_text( text );
+}
+
 void Hud::add_message( rtl::wstring_view text )
 {
     m_message.animate_text( text, timings::exposition );
@@ -39,9 +61,15 @@ void Hud::set_stat_line( unsigned index, rtl::wstring_view text )
     m_stats[index].set_text( text );
 }
 
+void Hud::set_frame_meter( const FrameMeter* meter )
+{
+    m_frame_meter = meter;
+}
+
 void Hud::update( rtl::chrono::thirds time )
 {
     m_status.update( time );
+    m_progress.update( time );
     m_message.update( time );
 
     for ( auto& stat : m_stats )
@@ -50,18 +78,89 @@ void Hud::update( rtl::chrono::thirds time )
 
 void Hud::draw( Font& font )
 {
+    // NOTE: The HUD is drawn in screen pixels with the origin at the bottom left corner
+    ::glMatrixMode( GL_PROJECTION );
+    ::glLoadIdentity();
+    ::glOrtho( 0.0, m_screen_width, 0.0, m_screen_height, -1.0, 1.0 );
+
+    ::glMatrixMode( GL_MODELVIEW );
+    ::glLoadIdentity();
+
     m_status.draw( font, font.size(), font.size() );
+    m_progress.draw( font, font.size(), font.size() * 2 );
     m_message.draw( font, font.size(), m_screen_height - font.size() );
 
     int line = 4;
     for ( auto& stat : m_stats )
         stat.draw( font, font.size() * 2, m_screen_height - font.size() * line++ );
+
+    if ( m_frame_meter && m_frame_meter->count() > 0 )
+        draw_frame_graph( font.size() * 2,
+                          m_screen_height - font.size() * ( line + 3 ),
+                          font.size() * 16,
+                          font.size() * 3 );
+
+    // NOTE: All the visible text goes in one batch
+    font.draw();
+}
+
+void Hud::draw_frame_graph( int x, int y, int width, int height )
+{
+    const FrameMeter::Summary summary = m_frame_meter->summary();
+
+    const float scale = static_cast<float>( height ) * graph::median_level
+                      / static_cast<float>( summary.p50 > 0 ? summary.p50 : 1 );
+
+    auto level = [&]( unsigned time )
+    {
+        const float offset = static_cast<float>( time ) * scale;
+
+        return static_cast<float>( y )
+             + ( offset < static_cast<float>( height ) ? offset : static_cast<float>( height ) );
+    };
+
+    ::glEnable( GL_BLEND );
+    ::glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+    ::glBegin( GL_LINES );
+    ::glColor4f( 1.0f, 0.0f, 1.0f, 0.35f );
+
+    const rtl::array<unsigned, 3> quantiles { summary.p50, summary.p99, summary.p999 };
+
+    for ( unsigned time : quantiles )
+    {
+        ::glVertex2f( static_cast<float>( x ), level( time ) );
+        ::glVertex2f( static_cast<float>( x + width ), level( time ) );
+    }
+
+    ::glEnd();
+
+    const size_t frames_count = m_frame_meter->count() < graph::frames_count
+                                  ? m_frame_meter->count()
+                                  : graph::frames_count;
+
+    // NOTE: The latest frame is on the right
+    ::glBegin( GL_LINE_STRIP );
+    ::glColor4f( 1.0f, 0.0f, 1.0f, 1.0f );
+
+    for ( size_t age = 0; age < frames_count; ++age )
+    {
+        const float offset
+            = static_cast<float>( age ) * static_cast<float>( width ) / graph::frames_count;
+
+        ::glVertex2f( static_cast<float>( x + width ) - offset,
+                      level( m_frame_meter->frame_time( age ) ) );
+    }
+
+    ::glEnd();
+    ::glDisable( GL_BLEND );
 }
 
 void Hud::Message::set_text( rtl::wstring_view text )
 {
-    text_to_hide = rtl::move( text_to_show );
-    text_to_show = text;
+    text_to_hide = text_to_show;
+    text_to_show.clear();
+    text_to_show.append( text );
 
     m_opacity_hide = 0.f;
     m_opacity_show = 1.f;
@@ -74,8 +173,9 @@ void Hud::Message::animate_text( rtl::wstring_view text, rtl::chrono::thirds exp
     if ( text_to_show == text )
         return;
 
-    text_to_hide = rtl::move( text_to_show );
-    text_to_show = text;
+    text_to_hide = text_to_show;
+    text_to_show.clear();
+    text_to_show.append( text );
 
     m_opacity_hide = m_opacity_show;
     m_opacity_show = 0.f;
@@ -126,7 +226,7 @@ void Hud::Message::update( rtl::chrono::thirds time )
     case State::Exposition:
         if ( time >= m_timeout_point )
         {
-            text_to_hide = rtl::move( text_to_show );
+            text_to_hide = text_to_show;
             text_to_show.clear();
 
             m_opacity_hide = m_opacity_show;
@@ -145,6 +245,6 @@ void Hud::Message::update( rtl::chrono::thirds time )
 
 void Hud::Message::draw( Font& font, int x, int y )
 {
-    font.draw( text_to_hide, x, y, m_opacity_hide );
-    font.draw( text_to_show, x, y, m_opacity_show );
+    font.add( text_to_hide.view(), x, y, m_opacity_hide );
+    font.add( text_to_show.view(), x, y, m_opacity_show );
 }
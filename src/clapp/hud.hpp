@@ -10,6 +10,8 @@
  */
 #pragma once
 
+#include "text.hpp"
+
 #include <rtl/array.hpp>
 #include <rtl/chrono.hpp>
 #include <rtl/string.hpp>
@@ -18,21 +20,30 @@ namespace clapp
 {
     class Renderer;
     class Font;
+    class FrameMeter;
 
     class Hud final
     {
     public:
+        static constexpr unsigned stat_lines_count = 9;
+
         void init( int screen_width, int screen_height );
 
         void set_status( rtl::wstring_view text );
+        void set_progress( rtl::wstring_view text );
         void add_message( rtl::wstring_view text );
 
         void set_stat_line( unsigned index, rtl::wstring_view text );
 
+        // NOTE: The graph of the latest frame times is drawn under the stats, if \meter is set
+        void set_frame_meter( const FrameMeter* meter );
+
         void update( rtl::chrono::thirds clock );
         void draw( Font& font );
 
     private:
+        void draw_frame_graph( int x, int y, int width, int height );
+
         class Message final
         {
         public:
@@ -46,8 +57,9 @@ namespace clapp
             void draw( Font& font, int x, int y );
 
         private:
-            rtl::wstring text_to_hide;
-            rtl::wstring text_to_show;
+            // NOTE: Fixed capacity, so the texts updated every frame don't allocate
+            Text text_to_hide;
+            Text text_to_show;
 
             enum class State
             {
@@ -67,10 +79,14 @@ namespace clapp
             float m_opacity_show { 0.f };
         };
 
-        Message                m_status;
-        Message                m_message;
-        rtl::array<Message, 5> m_stats;
+        Message                                m_status;
+        Message                                m_progress;
+        Message                                m_message;
+        rtl::array<Message, stat_lines_count> m_stats;
+
+        const FrameMeter* m_frame_meter { nullptr };
 
+        int m_screen_width { 0 };
         int m_screen_height { 0 };
     };
 }
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#include "recorder.hpp"
+
+#include <rtl/fourcc.hpp>
+
+using namespace clapp;
+
+namespace fs = rtl::filesystem;
+
+namespace filenames
+{
+    constexpr wchar_t image_prefix[] { L"clapp." };
+    constexpr wchar_t image_suffix[] { L".tga" };
+    constexpr wchar_t audio[] { L"clapp.wav" };
+}
+
+#pragma pack( push, 1 )
+namespace format
+{
+    namespace signatures
+    {
+        constexpr rtl::uint32_t riff = rtl::make_fourcc( 'R', 'I', 'F', 'F' );
+        constexpr rtl::uint32_t wave = rtl::make_fourcc( 'W', 'A', 'V', 'E' );
+        constexpr rtl::uint32_t fmt  = rtl::make_fourcc( 'f', 'm', 't', ' ' );
+        constexpr rtl::uint32_t data = rtl::make_fourcc( 'd', 'a', 't', 'a' );
+    }
+
+    struct wav
+    {
+        rtl::uint32_t riff_id;
+        rtl::uint32_t riff_size;
+        rtl::uint32_t wave_id;
+        rtl::uint32_t fmt_id;
+        rtl::uint32_t fmt_size;
+        rtl::uint16_t audio_format;
+        rtl::uint16_t channels;
+        rtl::uint32_t sample_rate;
+        rtl::uint32_t byte_rate;
+        rtl::uint16_t block_align;
+        rtl::uint16_t bits_per_sample;
+        rtl::uint32_t data_id;
+        rtl::uint32_t data_size;
+    };
+
+    struct tga
+    {
+        rtl::uint8_t  id_length;
+        rtl::uint8_t  color_map_type;
+        rtl::uint8_t  image_type;
+        rtl::uint16_t color_map_origin;
+        rtl::uint16_t color_map_length;
+        rtl::uint8_t  color_map_depth;
+        rtl::uint16_t x_origin;
+        rtl::uint16_t y_origin;
+        rtl::uint16_t width;
+        rtl::uint16_t height;
+        rtl::uint8_t  bits_per_pixel;
+        rtl::uint8_t  descriptor;
+    };
+}
+#pragma pack( pop )
+
+namespace
+{
+    constexpr unsigned audio_channels_count = 2;
+    constexpr size_t   image_number_length  = 6;
+
+    bool starts_with( const wchar_t* text, const wchar_t* prefix )
+    {
+        while ( *prefix )
+        {
+            if ( *text++ != *prefix++ )
+                return false;
+        }
+
+        return true;
+    }
+
+    bool parse_unsigned( const wchar_t*& text, unsigned& value )
+    {
+        while ( *text == L' ' || *text == L'\t' )
+            ++text;
+
+        if ( *text < L'0' || *text > L'9' )
+            return false;
+
+        value = 0;
+
+        while ( *text >= L'0' && *text <= L'9' )
+            value = value * 10 + static_cast<unsigned>( *text++ - L'0' );
+
+        return true;
+    }
+}
+
+bool Recorder::parse_command_line( const wchar_t* command_line, Params& params )
+{
+    constexpr wchar_t option[] { L"/render" };
+
+    for ( ; *command_line; ++command_line )
+    {
+        if ( !starts_with( command_line, option ) )
+            continue;
+
+        const wchar_t* text = command_line + sizeof( option ) / sizeof( wchar_t ) - 1;
+
+        if ( !parse_unsigned( text, params.frames_count ) || params.frames_count == 0 )
+            return false;
+
+        unsigned width, height;
+
+        if ( parse_unsigned( text, width ) && parse_unsigned( text, height ) )
+        {
+            params.width  = static_cast<int>( width );
+            params.height = static_cast<int>( height );
+
+            parse_unsigned( text, params.framerate );
+        }
+
+        return params.width > 0 && params.height > 0 && params.framerate > 0;
+    }
+
+    return false;
+}
+
+Recorder::Recorder( const Params& params, unsigned samples_per_second )
+    : m_params( params )
+    , m_samples_per_second( samples_per_second )
+    , m_samples_per_frame( samples_per_second / params.framerate )
+    , m_pixels( static_cast<size_t>( params.width ) * static_cast<size_t>( params.height ), 0 )
+    , m_samples( m_samples_per_frame * audio_channels_count, 0 )
+    , m_start( rtl::chrono::steady_clock::now() )
+{
+    m_wav = fs::file::open( filenames::audio,
+                            fs::file::access::write_only,
+                            fs::file::mode::create_always );
+
+    write_wav_header();
+}
+
+Recorder::~Recorder()
+{
+    // NOTE: Data size is known only at the end of recording
+    write_wav_header();
+}
+
+rtl::Application::Input Recorder::input( const rtl::Application::Input& input )
+{
+    rtl::Application::Input result = input;
+
+    result.keys = {};
+
+    result.screen.width               = m_params.width;
+    result.screen.height              = m_params.height;
+    result.audio.samples_per_frame    = m_samples_per_frame;
+    result.audio.samples_per_second   = m_samples_per_second;
+    result.audio.output_frame_pointer = m_samples.data();
+
+    return result;
+}
+
+void Recorder::write_frame()
+{
+    rtl::wstring number = rtl::to_wstring( m_frame_index );
+
+    while ( number.size() < image_number_length )
+        number = rtl::wstring( L"0" ) + number;
+
+    const rtl::wstring filename = rtl::wstring( filenames::image_prefix ) + number
+                                + rtl::wstring( filenames::image_suffix );
+
+    write_image( filename.c_str() );
+
+    if ( m_wav )
+    {
+        const unsigned bytes_to_write
+            = static_cast<unsigned>( m_samples.size() * sizeof( rtl::int16_t ) );
+
+        if ( m_wav.write( m_samples.data(), bytes_to_write ) == bytes_to_write )
+            m_wav_data_size += bytes_to_write;
+    }
+
+    ++m_frame_index;
+}
+
+unsigned Recorder::framerate() const
+{
+    const rtl::chrono::microseconds elapsed = rtl::chrono::steady_clock::now() - m_start;
+
+    if ( elapsed.count() <= 0 )
+        return 0;
+
+    return static_cast<unsigned>( m_frame_index * 1000000ull
+                                  / static_cast<rtl::uint64_t>( elapsed.count() ) );
+}
+
+void Recorder::write_image( const wchar_t* filename )
+{
+    auto f
+        = fs::file::open( filename, fs::file::access::write_only, fs::file::mode::create_always );
+    if ( !f )
+        return;
+
+    format::tga header { 0 };
+    header.image_type     = 2; // uncompressed true-color
+    header.width          = static_cast<rtl::uint16_t>( m_params.width );
+    header.height         = static_cast<rtl::uint16_t>( m_params.height );
+    header.bits_per_pixel = 32;
+    header.descriptor     = 0x28; // 8 alpha bits, top-left origin
+
+    f.write( &header, sizeof( header ) );
+    f.write( m_pixels.data(), static_cast<unsigned>( m_pixels.size() * sizeof( rtl::uint32_t ) ) );
+}
+
+void Recorder::write_wav_header()
+{
+    if ( !m_wav )
+        return;
+
+    constexpr rtl::uint16_t bits_per_sample = sizeof( rtl::int16_t ) * 8;
+    constexpr rtl::uint16_t block_align     = audio_channels_count * sizeof( rtl::int16_t );
+
+    format::wav header;
+    header.riff_id         = format::signatures::riff;
+    header.riff_size       = sizeof( header ) - sizeof( rtl::uint32_t ) * 2 + m_wav_data_size;
+    header.wave_id         = format::signatures::wave;
+    header.fmt_id          = format::signatures::fmt;
+    header.fmt_size        = 16;
+    header.audio_format    = 1; // PCM
+    header.channels        = audio_channels_count;
+    header.sample_rate     = m_samples_per_second;
+    header.byte_rate       = m_samples_per_second * block_align;
+    header.block_align     = block_align;
+    header.bits_per_sample = bits_per_sample;
+    header.data_id         = format::signatures::data;
+    header.data_size       = m_wav_data_size;
+
+    m_wav.seek( 0, fs::file::position::begin );
+    m_wav.write( &header, sizeof( header ) );
+    m_wav.seek( 0, fs::file::position::end );
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#pragma once
+
+#include <rtl/chrono.hpp>
+#include <rtl/string.hpp>
+#include <rtl/sys/application.hpp>
+#include <rtl/sys/filesystem.hpp>
+#include <rtl/vector.hpp>
+
+namespace clapp
+{
+    // Renders frames with the synthetic clock to TGA image sequence and WAV file
+    class Recorder final
+    {
+    public:
+        struct Params
+        {
+            unsigned frames_count { 0 };
+            int      width { 1280 };
+            int      height { 720 };
+            unsigned framerate { 60 };
+        };
+
+        // Command line format: /render <frames count> [<width> <height> [<framerate>]]
+        static bool parse_command_line( const wchar_t* command_line, Params& params );
+
+        Recorder( const Params& params, unsigned samples_per_second );
+        ~Recorder();
+
+        // Input for the next frame: fixed resolution, fixed sample rate, recorder's audio frame and
+        // no keys held, so the render doesn't depend on the keyboard
+        rtl::Application::Input input( const rtl::Application::Input& input );
+
+        rtl::uint32_t* pixels() { return m_pixels.data(); }
+
+        // Writes the pixels and audio samples of the frame, which was rendered with \input
+        void write_frame();
+
+        bool     completed() const { return m_frame_index >= m_params.frames_count; }
+        unsigned frame_index() const { return m_frame_index; }
+        unsigned frames_count() const { return m_params.frames_count; }
+
+        // Rendering throughput in frames per second
+        unsigned framerate() const;
+
+    private:
+        Recorder( const Recorder& )            = delete;
+        Recorder& operator=( const Recorder& ) = delete;
+
+        void write_image( const wchar_t* filename );
+        void write_wav_header();
+
+        Params   m_params;
+        unsigned m_samples_per_second { 0 };
+        unsigned m_samples_per_frame { 0 };
+        unsigned m_frame_index { 0 };
+
+        rtl::vector<rtl::uint32_t> m_pixels;
+        rtl::vector<rtl::int16_t>  m_samples;
+
+        rtl::filesystem::file m_wav;
+        rtl::uint32_t         m_wav_data_size { 0 };
+
+        rtl::chrono::steady_clock::time_point m_start;
+    };
+}
@@ -21,42 +21,329 @@
 #include <gl/GL.h>
 #pragma warning( pop )
 
+// NOTE: OpenGL 1.2+ definitions, which are missing in the Windows SDK headers
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_STATIC_DRAW 0x88E4
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_COMPILE_STATUS 0x8B81
+#define GL_LINK_STATUS 0x8B82
+
 // TODO: Check OpenGL errors?
 
 using namespace clapp;
 
+namespace
+{
+    typedef char    GLchar;
+    typedef INT_PTR GLsizeiptr;
+
+    // NOTE: OpenGL 3.3 functions are not exported by opengl32.dll, the context provides them.
+    // The context is created by RTL without the core profile attributes, so drivers give the
+    // compatibility profile, where the fixed function HUD keeps working. Without them the frame
+    // is drawn with the fixed function pipeline as well.
+    struct Gl
+    {
+        GLuint( WINAPI* CreateShader )( GLenum type );
+        void( WINAPI* ShaderSource )( GLuint shader,
+                                      GLsizei count,
+                                      const GLchar* const* string,
+                                      const GLint* length );
+        void( WINAPI* CompileShader )( GLuint shader );
+        void( WINAPI* GetShaderiv )( GLuint shader, GLenum pname, GLint* params );
+        void( WINAPI* DeleteShader )( GLuint shader );
+        GLuint( WINAPI* CreateProgram )();
+        void( WINAPI* AttachShader )( GLuint program, GLuint shader );
+        void( WINAPI* LinkProgram )( GLuint program );
+        void( WINAPI* GetProgramiv )( GLuint program, GLenum pname, GLint* params );
+        void( WINAPI* UseProgram )( GLuint program );
+        void( WINAPI* DeleteProgram )( GLuint program );
+        GLint( WINAPI* GetUniformLocation )( GLuint program, const GLchar* name );
+        void( WINAPI* Uniform1i )( GLint location, GLint v0 );
+        void( WINAPI* GenBuffers )( GLsizei n, GLuint* buffers );
+        void( WINAPI* BindBuffer )( GLenum target, GLuint buffer );
+        void( WINAPI* BufferData )( GLenum target,
+                                    GLsizeiptr size,
+                                    const void* data,
+                                    GLenum usage );
+        void( WINAPI* DeleteBuffers )( GLsizei n, const GLuint* buffers );
+        void( WINAPI* GenVertexArrays )( GLsizei n, GLuint* arrays );
+        void( WINAPI* BindVertexArray )( GLuint array );
+        void( WINAPI* DeleteVertexArrays )( GLsizei n, const GLuint* arrays );
+        void( WINAPI* VertexAttribPointer )( GLuint index,
+                                             GLint size,
+                                             GLenum type,
+                                             GLboolean normalized,
+                                             GLsizei stride,
+                                             const void* pointer );
+        void( WINAPI* EnableVertexAttribArray )( GLuint index );
+
+        // NOTE: OpenGL 4.2 or ARB_texture_storage, mutable textures are allocated without it
+        void( WINAPI* TexStorage2D )( GLenum target,
+                                      GLsizei levels,
+                                      GLenum internalformat,
+                                      GLsizei width,
+                                      GLsizei height );
+    };
+
+    Gl gl {};
+
+    template<typename T>
+    void load( T& function, const char* name )
+    {
+        function = reinterpret_cast<T>( ::wglGetProcAddress( name ) );
+    }
+
+    // Checks \GL_VERSION of the current context is at least \major.\minor
+    bool gl_version_at_least( int major, int minor )
+    {
+        const char* version = reinterpret_cast<const char*>( ::glGetString( GL_VERSION ) );
+
+        if ( !version )
+            return false;
+
+        int version_major = 0;
+        int version_minor = 0;
+
+        for ( ; *version >= '0' && *version <= '9'; ++version )
+            version_major = version_major * 10 + ( *version - '0' );
+
+        if ( *version == '.' )
+        {
+            for ( ++version; *version >= '0' && *version <= '9'; ++version )
+                version_minor = version_minor * 10 + ( *version - '0' );
+        }
+
+        return version_major > major || ( version_major == major && version_minor >= minor );
+    }
+
+    // Looks for \name in the space separated \GL_EXTENSIONS of the current context
+    bool gl_extension_supported( const char* name )
+    {
+        const char* extension = reinterpret_cast<const char*>( ::glGetString( GL_EXTENSIONS ) );
+
+        if ( !extension )
+            return false;
+
+        while ( *extension )
+        {
+            const char* expected = name;
+
+            while ( *expected && *extension == *expected )
+            {
+                ++extension;
+                ++expected;
+            }
+
+            if ( !*expected && ( *extension == ' ' || *extension == '\0' ) )
+                return true;
+
+            while ( *extension && *extension != ' ' )
+                ++extension;
+
+            while ( *extension == ' ' )
+                ++extension;
+        }
+
+        return false;
+    }
+
+    // NOTE: Returns false, if the context is older than the shaders or any of the functions of
+    // the shader path is missing
+    bool load_gl()
+    {
+        // NOTE: Some drivers return a non-null pointer for any name, so the pointers of an older
+        // context can't be trusted
+        if ( !gl_version_at_least( 3, 3 ) )
+            return false;
+
+        load( gl.CreateShader, "glCreateShader" );
+        load( gl.ShaderSource, "glShaderSource" );
+        load( gl.CompileShader, "glCompileShader" );
+        load( gl.GetShaderiv, "glGetShaderiv" );
+        load( gl.DeleteShader, "glDeleteShader" );
+        load( gl.CreateProgram, "glCreateProgram" );
+        load( gl.AttachShader, "glAttachShader" );
+        load( gl.LinkProgram, "glLinkProgram" );
+        load( gl.GetProgramiv, "glGetProgramiv" );
+        load( gl.UseProgram, "glUseProgram" );
+        load( gl.DeleteProgram, "glDeleteProgram" );
+        load( gl.GetUniformLocation, "glGetUniformLocation" );
+        load( gl.Uniform1i, "glUniform1i" );
+        load( gl.GenBuffers, "glGenBuffers" );
+        load( gl.BindBuffer, "glBindBuffer" );
+        load( gl.BufferData, "glBufferData" );
+        load( gl.DeleteBuffers, "glDeleteBuffers" );
+        load( gl.GenVertexArrays, "glGenVertexArrays" );
+        load( gl.BindVertexArray, "glBindVertexArray" );
+        load( gl.DeleteVertexArrays, "glDeleteVertexArrays" );
+        load( gl.VertexAttribPointer, "glVertexAttribPointer" );
+        load( gl.EnableVertexAttribArray, "glEnableVertexAttribArray" );
+
+        // NOTE: Some drivers return a non-null pointer for any name, so the version is checked
+        if ( gl_version_at_least( 4, 2 ) || gl_extension_supported( "GL_ARB_texture_storage" ) )
+            load( gl.TexStorage2D, "glTexStorage2D" );
+        else
+            gl.TexStorage2D = nullptr;
+
+        return gl.CreateShader && gl.ShaderSource && gl.CompileShader && gl.GetShaderiv
+               && gl.DeleteShader && gl.CreateProgram && gl.AttachShader && gl.LinkProgram
+               && gl.GetProgramiv && gl.UseProgram && gl.DeleteProgram && gl.GetUniformLocation
+               && gl.Uniform1i && gl.GenBuffers && gl.BindBuffer && gl.BufferData
+               && gl.DeleteBuffers && gl.GenVertexArrays && gl.BindVertexArray
+               && gl.DeleteVertexArrays && gl.VertexAttribPointer && gl.EnableVertexAttribArray;
+    }
+
+    namespace shaders
+    {
+        constexpr char vertex[] {
+            "#version 330\n"
+            "layout( location = 0 ) in vec2 position;\n"
+            "layout( location = 1 ) in vec2 coord;\n"
+            "out vec2 frame_coord;\n"
+            "void main()\n"
+            "{\n"
+            "    frame_coord = coord;\n"
+            "    gl_Position = vec4( position, 0.0, 1.0 );\n"
+            "}\n" };
+
+        // NOTE: Presentation filters, such as gamma correction, belong here. The fragment shader
+        // is bound by the texture fetch, so a few more instructions are free.
+        constexpr char fragment[] {
+            "#version 330\n"
+            "uniform sampler2D frame;\n"
+            "in vec2 frame_coord;\n"
+            "out vec4 color;\n"
+            "void main()\n"
+            "{\n"
+            "    color = vec4( texture( frame, frame_coord ).rgb, 1.0 );\n"
+            "}\n" };
+    }
+
+    // NOTE: Full screen triangle strip of the position and the texture coordinate pairs.
+    // The first row of the frame is on the top of the screen.
+    constexpr GLfloat quad[] {
+        -1.f, -1.f, 0.f, 1.f, //
+        1.f,  -1.f, 1.f, 1.f, //
+        -1.f, 1.f,  0.f, 0.f, //
+        1.f,  1.f,  1.f, 0.f, //
+    };
+
+    // NOTE: Returns zero, if the shader is not compiled
+    GLuint compile_shader( GLenum type, const char* source )
+    {
+        GLuint shader = gl.CreateShader( type );
+
+        gl.ShaderSource( shader, 1, &source, nullptr );
+        gl.CompileShader( shader );
+
+        GLint status = GL_FALSE;
+        gl.GetShaderiv( shader, GL_COMPILE_STATUS, &status );
+        RTL_ASSERT( status == GL_TRUE );
+
+        if ( status != GL_TRUE )
+        {
+            gl.DeleteShader( shader );
+            return 0;
+        }
+
+        return shader;
+    }
+}
+
 Renderer::~Renderer()
 {
     cleanup();
+
+    if ( m_program != 0 )
+    {
+        gl.DeleteProgram( m_program );
+        gl.DeleteVertexArrays( 1, &m_vertex_array );
+        gl.DeleteBuffers( 1, &m_vertex_buffer );
+    }
 }
 
-void Renderer::init( int width, int height )
+void Renderer::init( int      screen_width,
+                     int      screen_height,
+                     int      texture_width,
+                     int      texture_height,
+                     unsigned texture_count,
+                     Filter   filter )
 {
-    m_width  = width;
-    m_height = height;
+    m_width          = screen_width;
+    m_height         = screen_height;
+    m_texture_width  = texture_width;
+    m_texture_height = texture_height;
 
-    ::glViewport( 0, 0, width, height );
+    ::glViewport( 0, 0, screen_width, screen_height );
     ::glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
 
+    if ( !m_gl_loaded )
+    {
+        m_gl_loaded = true;
+
+        if ( load_gl() )
+            create_program();
+    }
+
     cleanup();
 
-    ::glEnable( GL_TEXTURE_2D );
-    ::glGenTextures( 1, &m_texture );
-    ::glBindTexture( GL_TEXTURE_2D, m_texture );
-    ::glTexImage2D( GL_TEXTURE_2D,
-                    0,
-                    GL_RGBA,
-                    width,
-                    height,
-                    0,
-                    GL_RGBA,
-                    GL_UNSIGNED_BYTE,
-                    nullptr );
-
-    ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-    ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    m_textures.resize( texture_count );
+
+    const GLint gl_filter = filter == Filter::linear ? GL_LINEAR : GL_NEAREST;
+
+    // NOTE: Contents of the new textures are undefined, but they are presented until the program
+    // writes them: while the first build runs and right after init with frames in flight
+    const rtl::vector<rtl::uint32_t> black( static_cast<size_t>( texture_width )
+                                                * static_cast<size_t>( texture_height ),
+                                            0 );
+
+    ::glGenTextures( static_cast<GLsizei>( m_textures.size() ), m_textures.data() );
+
+    for ( unsigned texture : m_textures )
+    {
+        ::glBindTexture( GL_TEXTURE_2D, texture );
+
+        // NOTE: Textures are recreated on resize anyway, so they are immutable, if supported
+        if ( gl.TexStorage2D )
+        {
+            gl.TexStorage2D( GL_TEXTURE_2D, 1, GL_RGBA8, texture_width, texture_height );
+        }
+        else
+        {
+            ::glTexImage2D( GL_TEXTURE_2D,
+                            0,
+                            GL_RGBA8,
+                            texture_width,
+                            texture_height,
+                            0,
+                            GL_RGBA,
+                            GL_UNSIGNED_BYTE,
+                            nullptr );
+        }
+
+        ::glTexSubImage2D( GL_TEXTURE_2D,
+                           0,
+                           0,
+                           0,
+                           texture_width,
+                           texture_height,
+                           GL_RGBA,
+                           GL_UNSIGNED_BYTE,
+                           black.data() );
+
+        // NOTE: Linear filter samples across the edges of the stretched texture otherwise
+        ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, gl_filter );
+        ::glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, gl_filter );
+    }
+
+    ::glBindTexture( GL_TEXTURE_2D, 0 );
 }
 
 void Renderer::clear()
@@ -64,11 +351,29 @@ void Renderer::clear()
     ::glClear( GL_COLOR_BUFFER_BIT );
 }
 
-void Renderer::draw()
+void Renderer::draw( unsigned texture_index )
 {
-    // TODO: Use OpenGL 3.x API with shaders
-    ::glClear( GL_COLOR_BUFFER_BIT );
+    if ( m_program == 0 )
+    {
+        draw_fixed_function( texture_index );
+        return;
+    }
+
+    // NOTE: The quad covers the whole screen, so there is nothing to clear
+    gl.UseProgram( m_program );
+    gl.BindVertexArray( m_vertex_array );
+    ::glBindTexture( GL_TEXTURE_2D, m_textures[texture_index] );
+
+    ::glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+
+    // NOTE: The HUD is drawn with the fixed function pipeline afterwards
+    ::glBindTexture( GL_TEXTURE_2D, 0 );
+    gl.BindVertexArray( 0 );
+    gl.UseProgram( 0 );
+}
 
+void Renderer::draw_fixed_function( unsigned texture_index )
+{
     ::glMatrixMode( GL_PROJECTION );
     ::glLoadIdentity();
     ::glOrtho( 0.0, m_width, 0.0, m_height, -1.0, 1.0 );
@@ -77,7 +382,7 @@ void Renderer::draw()
     ::glLoadIdentity();
 
     ::glEnable( GL_TEXTURE_2D );
-    ::glBindTexture( GL_TEXTURE_2D, m_texture );
+    ::glBindTexture( GL_TEXTURE_2D, m_textures[texture_index] );
 
     ::glBegin( GL_QUADS );
     ::glColor3f( 1.f, 1.f, 1.f );
@@ -91,14 +396,83 @@ void Renderer::draw()
     ::glVertex2i( 0, 0 );
     ::glEnd();
 
+    ::glBindTexture( GL_TEXTURE_2D, 0 );
     ::glDisable( GL_TEXTURE_2D );
 }
 
+void Renderer::read( unsigned texture_index, rtl::uint32_t* pixels )
+{
+    ::glBindTexture( GL_TEXTURE_2D, m_textures[texture_index] );
+    ::glGetTexImage( GL_TEXTURE_2D, 0, GL_BGRA_EXT, GL_UNSIGNED_BYTE, pixels );
+}
+
+void Renderer::create_program()
+{
+    const GLuint vertex_shader   = compile_shader( GL_VERTEX_SHADER, shaders::vertex );
+    const GLuint fragment_shader = compile_shader( GL_FRAGMENT_SHADER, shaders::fragment );
+
+    GLint status = GL_FALSE;
+
+    if ( vertex_shader != 0 && fragment_shader != 0 )
+    {
+        m_program = gl.CreateProgram();
+        gl.AttachShader( m_program, vertex_shader );
+        gl.AttachShader( m_program, fragment_shader );
+        gl.LinkProgram( m_program );
+
+        gl.GetProgramiv( m_program, GL_LINK_STATUS, &status );
+        RTL_ASSERT( status == GL_TRUE );
+    }
+
+    // NOTE: The program keeps the shaders until it is deleted
+    if ( vertex_shader != 0 )
+        gl.DeleteShader( vertex_shader );
+
+    if ( fragment_shader != 0 )
+        gl.DeleteShader( fragment_shader );
+
+    // NOTE: The frame is drawn with the fixed function pipeline then
+    if ( status != GL_TRUE )
+    {
+        if ( m_program != 0 )
+            gl.DeleteProgram( m_program );
+
+        m_program = 0;
+        return;
+    }
+
+    gl.UseProgram( m_program );
+    gl.Uniform1i( gl.GetUniformLocation( m_program, "frame" ), 0 );
+    gl.UseProgram( 0 );
+
+    gl.GenVertexArrays( 1, &m_vertex_array );
+    gl.GenBuffers( 1, &m_vertex_buffer );
+
+    gl.BindVertexArray( m_vertex_array );
+    gl.BindBuffer( GL_ARRAY_BUFFER, m_vertex_buffer );
+    gl.BufferData( GL_ARRAY_BUFFER, sizeof( quad ), quad, GL_STATIC_DRAW );
+
+    constexpr GLsizei stride = 4 * sizeof( GLfloat );
+
+    gl.VertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, stride, nullptr );
+    gl.VertexAttribPointer( 1,
+                            2,
+                            GL_FLOAT,
+                            GL_FALSE,
+                            stride,
+                            reinterpret_cast<const void*>( 2 * sizeof( GLfloat ) ) );
+    gl.EnableVertexAttribArray( 0 );
+    gl.EnableVertexAttribArray( 1 );
+
+    gl.BindVertexArray( 0 );
+    gl.BindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
 void Renderer::cleanup()
 {
-    if ( ::glIsTexture( m_texture ) )
+    if ( !m_textures.empty() )
     {
-        ::glDeleteTextures( 1, &m_texture );
-        m_texture = 0;
+        ::glDeleteTextures( static_cast<GLsizei>( m_textures.size() ), m_textures.data() );
+        m_textures.clear();
     }
 }
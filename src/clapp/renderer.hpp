@@ -10,21 +10,40 @@
  */
 #pragma once
 
+#include <rtl/vector.hpp>
+
 namespace clapp
 {
     class Renderer final
     {
     public:
+        enum class Filter
+        {
+            nearest,
+            linear
+        };
+
         Renderer() = default;
         ~Renderer();
 
-        void init( int width, int height );
+        // NOTE: Textures are stretched to the screen with \filter
+        void init( int      screen_width,
+                   int      screen_height,
+                   int      texture_width,
+                   int      texture_height,
+                   unsigned texture_count,
+                   Filter   filter = Filter::nearest );
+
+        // NOTE: Single draw call of the static quad with the texture of \texture_index. Falls back
+        // to the fixed function pipeline, if the context lacks OpenGL 3.3.
+        void draw( unsigned texture_index );
 
-        void draw();
+        // Reads texture pixels back as 32-bit BGRA values
+        void read( unsigned texture_index, rtl::uint32_t* pixels );
 
         void clear();
 
-        unsigned texture() const { return m_texture; }
+        const rtl::vector<unsigned>& textures() const { return m_textures; }
 
     private:
         Renderer( const Renderer& )            = delete;
@@ -32,8 +51,21 @@ namespace clapp
 
         void cleanup();
 
-        unsigned m_texture { 0 };
-        int      m_width { 0 };
-        int      m_height { 0 };
+        // NOTE: The shader program and the quad don't depend on the screen, so they are
+        // created on the first \init only. The program stays zero, if it can't be created.
+        void create_program();
+
+        void draw_fixed_function( unsigned texture_index );
+
+        bool     m_gl_loaded { false };
+        unsigned m_program { 0 };
+        unsigned m_vertex_array { 0 };
+        unsigned m_vertex_buffer { 0 };
+
+        rtl::vector<unsigned> m_textures;
+        int                   m_width { 0 };
+        int                   m_height { 0 };
+        int                   m_texture_width { 0 };
+        int                   m_texture_height { 0 };
     };
 }
@@ -50,6 +50,7 @@ namespace format
         constexpr rtl::uint32_t clap = rtl::make_fourcc( 'C', 'L', 'A', 'P' );
         constexpr rtl::uint32_t ocld = rtl::make_fourcc( 'O', 'C', 'L', 'D' );
         constexpr rtl::uint32_t adio = rtl::make_fourcc( 'A', 'D', 'I', 'O' );
+        constexpr rtl::uint32_t vdeo = rtl::make_fourcc( 'V', 'D', 'E', 'O' );
     }
 
     namespace versions
@@ -73,6 +74,12 @@ namespace format
         rtl::uint32_t sample_rate;
         rtl::uint32_t buffer_count;
     };
+
+    struct video
+    {
+        rtl::uint32_t frames_in_flight;
+        rtl::uint32_t render_scale;
+    };
 }
 #pragma pack( pop )
 
@@ -162,6 +169,8 @@ class Settings::Impl
 public:
     unsigned                 target_audio_sample_rate { 48000 };
     unsigned                 target_audio_buffer_count { 4 };
+    unsigned                 target_frames_in_flight { 1 };
+    unsigned                 target_render_scale { 1 };
     rtl::opencl::device_list target_device_list;
     unsigned                 target_device_index { 0 };
     rtl::string              target_device_name;
@@ -220,6 +229,56 @@ public:
         RTL_ASSERT( lresult != CB_ERR );
     }
 
+    void init_frames_in_flight( HWND hwnd, int control_id )
+    {
+        size_t selection_index = 0;
+
+        // NOTE: The device queue is in-order, so more than two frames in flight give nothing
+        constexpr rtl::array<unsigned, 2> frames_count { 1, 2 };
+
+        for ( size_t i = 0; i < frames_count.size(); ++i )
+        {
+            const unsigned count = frames_count[i];
+
+            if ( count <= target_frames_in_flight )
+                selection_index = i;
+
+            const rtl::wstring text = rtl::to_wstring( count );
+
+            add_combobox_item( hwnd, control_id, text.c_str(), count );
+        }
+
+        [[maybe_unused]] LRESULT lresult
+            = ::SendDlgItemMessageW( hwnd, control_id, CB_SETCURSEL, selection_index, 0 );
+        RTL_ASSERT( lresult != CB_ERR );
+    }
+
+    void init_render_scale( HWND hwnd, int control_id )
+    {
+        size_t selection_index = 0;
+
+        // NOTE: Zero stands for the scale picked automatically
+        constexpr rtl::array<unsigned, 5> render_scales { 0, 1, 2, 4, 8 };
+
+        for ( size_t i = 0; i < render_scales.size(); ++i )
+        {
+            const unsigned scale = render_scales[i];
+
+            if ( scale <= target_render_scale )
+                selection_index = i;
+
+            // TODO: Take strings from resources
+            const rtl::wstring text = scale != 0 ? rtl::wstring( L"1:" ) + rtl::to_wstring( scale )
+                                                 : rtl::wstring( L"Auto" );
+
+            add_combobox_item( hwnd, control_id, text.c_str(), scale );
+        }
+
+        [[maybe_unused]] LRESULT lresult
+            = ::SendDlgItemMessageW( hwnd, control_id, CB_SETCURSEL, selection_index, 0 );
+        RTL_ASSERT( lresult != CB_ERR );
+    }
+
     void init_opencl_device( HWND hwnd, int control_id )
     {
         [[maybe_unused]] LRESULT lresult;
@@ -273,6 +332,34 @@ public:
         }
     }
 
+    bool select_opencl_device()
+    {
+        auto platforms     = rtl::opencl::platform::query_list();
+        target_device_list = rtl::opencl::device::query_list( platforms );
+
+        bool found = false;
+
+        for ( size_t i = 0; i < target_device_list.size(); ++i )
+        {
+            auto& device = target_device_list[i];
+
+            if ( !device.extension_supported( target_opencl_extension ) )
+                continue;
+
+            // NOTE: The device from the settings file is preferred to the first suitable one
+            if ( !found || device.name() == target_device_name )
+            {
+                target_device_index = static_cast<unsigned>( i );
+                found               = true;
+            }
+        }
+
+        if ( found )
+            target_device_name = target_device_list[target_device_index].name();
+
+        return found;
+    }
+
     void init( HWND hwnd )
     {
         // NOTE: The dialog will not appear on top of the fullscreen window without this code!
@@ -296,6 +383,8 @@ public:
         init_audio_rate( hwnd, CLAPP_ID_CONTROL_AUDIO_RATE );
         init_audio_buffer_size( hwnd, CLAPP_ID_CONTROL_AUDIO_BUFFERS );
         init_opencl_device( hwnd, CLAPP_ID_CONTROL_OPENCL_DEVICE );
+        init_frames_in_flight( hwnd, CLAPP_ID_CONTROL_FRAMES_IN_FLIGHT );
+        init_render_scale( hwnd, CLAPP_ID_CONTROL_RENDER_SCALE );
         update_max_latency( hwnd );
         update_opencl_device( hwnd );
 
@@ -468,6 +557,10 @@ public:
             = get_combobox_selected_item_data<unsigned>( hwnd, CLAPP_ID_CONTROL_AUDIO_RATE );
         target_audio_buffer_count
             = get_combobox_selected_item_data<unsigned>( hwnd, CLAPP_ID_CONTROL_AUDIO_BUFFERS );
+        target_frames_in_flight
+            = get_combobox_selected_item_data<unsigned>( hwnd, CLAPP_ID_CONTROL_FRAMES_IN_FLIGHT );
+        target_render_scale
+            = get_combobox_selected_item_data<unsigned>( hwnd, CLAPP_ID_CONTROL_RENDER_SCALE );
 
         target_device_name = target_device_list[target_device_index].name();
 
@@ -569,6 +662,13 @@ bool Settings::setup( void* parent_window, unsigned display_framerate )
     return dlg_result > 0;
 }
 
+bool Settings::setup_unattended( unsigned display_framerate )
+{
+    m_impl->target_monitor_frame_rate = display_framerate;
+
+    return m_impl->select_opencl_device();
+}
+
 void Settings::load( const wchar_t* filename )
 {
     auto f = file::open( filename, file::access::read_only, file::mode::open_existing );
@@ -627,6 +727,31 @@ void Settings::load( const wchar_t* filename )
         m_impl->target_audio_sample_rate  = audio.sample_rate;
         m_impl->target_audio_buffer_count = audio.buffer_count;
     }
+
+    {
+        format::riff header { 0 };
+
+        // NOTE: The files written by the previous versions have no video settings
+        if ( f.read( &header, sizeof( header ) ) != sizeof( header ) )
+            return;
+
+        if ( header.id != format::signatures::vdeo )
+            return;
+
+        // NOTE: The previous versions have no render scale
+        if ( header.size != sizeof( format::video )
+             && header.size != sizeof( format::video::frames_in_flight ) )
+            return;
+
+        format::video video { 0 };
+        read_bytes = f.read( &video, header.size );
+        RTL_ASSERT( read_bytes == header.size );
+
+        m_impl->target_frames_in_flight = video.frames_in_flight;
+
+        if ( header.size == sizeof( format::video ) )
+            m_impl->target_render_scale = video.render_scale;
+    }
 }
 
 void Settings::save( const wchar_t* filename )
@@ -668,6 +793,19 @@ void Settings::save( const wchar_t* filename )
         f.write( &header, sizeof( header ) );
         f.write( &audio, sizeof( audio ) );
     }
+
+    {
+        format::riff header;
+        header.id   = format::signatures::vdeo;
+        header.size = sizeof( format::video );
+
+        format::video video;
+        video.frames_in_flight = m_impl->target_frames_in_flight;
+        video.render_scale     = m_impl->target_render_scale;
+
+        f.write( &header, sizeof( header ) );
+        f.write( &video, sizeof( video ) );
+    }
 }
 
 const rtl::opencl::device& Settings::target_opencl_device() const
@@ -685,3 +823,13 @@ unsigned Settings::target_audio_max_latency() const
     return m_impl->target_audio_sample_rate / m_impl->target_monitor_frame_rate
          * m_impl->target_audio_buffer_count;
 }
+
+unsigned Settings::target_frames_in_flight() const
+{
+    return m_impl->target_frames_in_flight;
+}
+
+unsigned Settings::target_render_scale() const
+{
+    return m_impl->target_render_scale;
+}
@@ -26,9 +26,16 @@ namespace clapp
         void save( const wchar_t* filename );
         bool setup( void* parent_window, unsigned display_framerate );
 
+        // Applies loaded settings without the dialog
+        bool setup_unattended( unsigned display_framerate );
+
         const rtl::opencl::device& target_opencl_device() const;
         unsigned                   target_audio_sample_rate() const;
         unsigned                   target_audio_max_latency() const;
+        unsigned                   target_frames_in_flight() const;
+
+        // Screen to render resolution ratio: 1, 2, 4 or 8, zero means automatic
+        unsigned target_render_scale() const;
 
     private:
         class Impl;
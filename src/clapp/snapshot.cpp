@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#include "snapshot.hpp"
+
+#include <rtl/array.hpp>
+#include <rtl/fourcc.hpp>
+#include <rtl/sys/debug.hpp>
+#include <rtl/string.hpp>
+#include <rtl/sys/filesystem.hpp>
+
+#pragma warning( push )
+#pragma warning( disable : 4668 )
+#define NOMINMAX
+#include <Windows.h>
+#pragma warning( pop )
+
+using namespace clapp;
+
+namespace fs = rtl::filesystem;
+
+#pragma pack( push, 1 )
+namespace format
+{
+    namespace signatures
+    {
+        constexpr rtl::uint32_t clst = rtl::make_fourcc( 'C', 'L', 'S', 'T' );
+    }
+
+    namespace versions
+    {
+        constexpr rtl::uint32_t v1 = 1;
+        constexpr rtl::uint32_t v2 = 2;
+    }
+
+    // NOTE: Followed by the layout (since v2), the sizes of encoded blocks (in cells) and the
+    // encoded blocks
+    struct snapshot
+    {
+        rtl::uint32_t id;
+        rtl::uint32_t version;
+        rtl::uint32_t cells_count;
+        rtl::uint32_t block_cells_count;
+        rtl::uint32_t blocks_count;
+    };
+
+    struct layout
+    {
+        rtl::uint32_t grid_width;
+        rtl::uint32_t grid_height;
+    };
+}
+#pragma pack( pop )
+
+namespace
+{
+    constexpr size_t block_cells_count = 64 * 1024;
+    constexpr size_t max_threads_count = 64;
+
+    // NOTE: The background save shares the CPU with the running frames
+    constexpr size_t max_background_threads_count = 4;
+
+    constexpr wchar_t temp_suffix[] { L".tmp" };
+
+    // NOTE: Raw state dumps and v1 snapshots were sized for the 7680x4320 screen
+    constexpr Snapshot::Layout legacy_layout { 7680 / 4, 4320 / 4 };
+
+    // Each encoded run consists of zero cells count, literal cells count and the literal cells
+    void encode( const rtl::uint32_t* cells, size_t count, rtl::vector<rtl::uint32_t>& output )
+    {
+        output.clear();
+
+        size_t i = 0;
+
+        while ( i < count )
+        {
+            const size_t zeros_start = i;
+
+            while ( i < count && cells[i] == 0 )
+                ++i;
+
+            const size_t literals_start = i;
+
+            // NOTE: A single zero between literals is cheaper to keep than to start a new run
+            while ( i < count && ( cells[i] != 0 || ( i + 1 < count && cells[i + 1] != 0 ) ) )
+                ++i;
+
+            output.push_back( static_cast<rtl::uint32_t>( literals_start - zeros_start ) );
+            output.push_back( static_cast<rtl::uint32_t>( i - literals_start ) );
+
+            for ( size_t j = literals_start; j < i; ++j )
+                output.push_back( cells[j] );
+        }
+    }
+
+    bool decode( const rtl::uint32_t* data, size_t size, rtl::uint32_t* cells, size_t count )
+    {
+        size_t i = 0;
+        size_t c = 0;
+
+        while ( i + 2 <= size )
+        {
+            const size_t zeros    = data[i++];
+            const size_t literals = data[i++];
+
+            if ( c + zeros + literals > count || i + literals > size )
+                return false;
+
+            for ( size_t j = 0; j < zeros; ++j )
+                cells[c++] = 0;
+
+            for ( size_t j = 0; j < literals; ++j )
+                cells[c++] = data[i++];
+        }
+
+        return i == size && c == count;
+    }
+
+    template <typename Process>
+    struct Blocks
+    {
+        Process&      process;
+        size_t        count;
+        volatile LONG next;
+        volatile LONG failed;
+    };
+
+    template <typename Process>
+    DWORD WINAPI process_blocks_thread( LPVOID param )
+    {
+        auto& blocks = *static_cast<Blocks<Process>*>( param );
+
+        for ( ;; )
+        {
+            const size_t index = static_cast<size_t>( ::InterlockedIncrement( &blocks.next ) - 1 );
+
+            if ( index >= blocks.count )
+                break;
+
+            if ( !blocks.process( index ) )
+                ::InterlockedExchange( &blocks.failed, 1 );
+        }
+
+        return 0;
+    }
+
+    // NOTE: In background one core is left to the calling application
+    size_t threads_count_for( bool background )
+    {
+        SYSTEM_INFO info;
+        ::GetSystemInfo( &info );
+
+        size_t threads_count = info.dwNumberOfProcessors;
+
+        if ( background )
+        {
+            threads_count = threads_count > 1 ? threads_count - 1 : 1;
+
+            if ( threads_count > max_background_threads_count )
+                threads_count = max_background_threads_count;
+        }
+
+        if ( threads_count > max_threads_count )
+            threads_count = max_threads_count;
+
+        return threads_count;
+    }
+
+    // Calls \process( block_index ) for every block on all CPU cores, or on a few of them in
+    // \background
+    template <typename Process>
+    bool process_blocks( size_t blocks_count, bool background, Process process )
+    {
+        Blocks<Process> blocks { process, blocks_count, 0, 0 };
+
+        size_t threads_count = threads_count_for( background );
+
+        if ( threads_count > blocks_count )
+            threads_count = blocks_count;
+
+        rtl::array<HANDLE, max_threads_count> threads {};
+
+        // NOTE: The calling thread processes blocks as well
+        for ( size_t i = 1; i < threads_count; ++i )
+        {
+            threads[i] = ::CreateThread(
+                nullptr, 0, &process_blocks_thread<Process>, &blocks, 0, nullptr );
+            RTL_ASSERT( threads[i] != nullptr );
+        }
+
+        process_blocks_thread<Process>( &blocks );
+
+        for ( size_t i = 1; i < threads_count; ++i )
+        {
+            if ( threads[i] )
+            {
+                ::WaitForSingleObject( threads[i], INFINITE );
+                ::CloseHandle( threads[i] );
+            }
+        }
+
+        return blocks.failed == 0;
+    }
+
+    size_t block_size( size_t index, size_t cells_count )
+    {
+        const size_t first = index * block_cells_count;
+
+        return cells_count - first < block_cells_count ? cells_count - first : block_cells_count;
+    }
+
+    bool write( const wchar_t*                                 filename,
+                const Snapshot::Layout&                        layout,
+                const rtl::vector<rtl::vector<rtl::uint32_t>>& blocks )
+    {
+        auto f = fs::file::open(
+            filename, fs::file::access::write_only, fs::file::mode::create_always );
+        if ( !f )
+            return false;
+
+        format::snapshot header;
+        header.id                = format::signatures::clst;
+        header.version           = format::versions::v2;
+        header.cells_count       = static_cast<rtl::uint32_t>( layout.cells_count() );
+        header.block_cells_count = static_cast<rtl::uint32_t>( block_cells_count );
+        header.blocks_count      = static_cast<rtl::uint32_t>( blocks.size() );
+
+        rtl::vector<rtl::uint32_t> sizes( blocks.size(), 0 );
+
+        for ( size_t i = 0; i < blocks.size(); ++i )
+            sizes[i] = static_cast<rtl::uint32_t>( blocks[i].size() );
+
+        format::layout grid;
+        grid.grid_width  = layout.grid_width;
+        grid.grid_height = layout.grid_height;
+
+        if ( f.write( &header, sizeof( header ) ) != sizeof( header ) )
+            return false;
+
+        if ( f.write( &grid, sizeof( grid ) ) != sizeof( grid ) )
+            return false;
+
+        const unsigned sizes_bytes
+            = static_cast<unsigned>( sizes.size() * sizeof( rtl::uint32_t ) );
+
+        if ( f.write( sizes.data(), sizes_bytes ) != sizes_bytes )
+            return false;
+
+        for ( const auto& block : blocks )
+        {
+            const unsigned bytes_to_write
+                = static_cast<unsigned>( block.size() * sizeof( rtl::uint32_t ) );
+
+            if ( f.write( block.data(), bytes_to_write ) != bytes_to_write )
+                return false;
+        }
+
+        return true;
+    }
+
+    // Read-only view of the whole file
+    class MappedFile final
+    {
+    public:
+        explicit MappedFile( const wchar_t* filename )
+        {
+            m_file = ::CreateFileW( filename,
+                                    GENERIC_READ,
+                                    FILE_SHARE_READ,
+                                    nullptr,
+                                    OPEN_EXISTING,
+                                    FILE_FLAG_SEQUENTIAL_SCAN,
+                                    nullptr );
+            if ( m_file == INVALID_HANDLE_VALUE )
+                return;
+
+            LARGE_INTEGER size;
+            if ( !::GetFileSizeEx( m_file, &size ) || size.QuadPart == 0 )
+                return;
+
+            m_mapping = ::CreateFileMappingW( m_file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+            if ( !m_mapping )
+                return;
+
+            m_data = ::MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 );
+            if ( m_data )
+                m_size = static_cast<size_t>( size.QuadPart );
+        }
+
+        ~MappedFile()
+        {
+            if ( m_data )
+                ::UnmapViewOfFile( m_data );
+
+            if ( m_mapping )
+                ::CloseHandle( m_mapping );
+
+            if ( m_file != INVALID_HANDLE_VALUE )
+                ::CloseHandle( m_file );
+        }
+
+        const void* data() const { return m_data; }
+        size_t      size() const { return m_size; }
+
+    private:
+        MappedFile( const MappedFile& )            = delete;
+        MappedFile& operator=( const MappedFile& ) = delete;
+
+        HANDLE m_file { INVALID_HANDLE_VALUE };
+        HANDLE m_mapping { nullptr };
+        void*  m_data { nullptr };
+        size_t m_size { 0 };
+    };
+}
+
+bool Snapshot::save( const wchar_t*       filename,
+                     const Layout&        layout,
+                     const rtl::uint32_t* cells,
+                     bool                 background )
+{
+    const size_t cells_count  = layout.cells_count();
+    const size_t blocks_count = ( cells_count + block_cells_count - 1 ) / block_cells_count;
+
+    rtl::vector<rtl::vector<rtl::uint32_t>> blocks( blocks_count );
+
+    process_blocks( blocks_count,
+                    background,
+                    [&]( size_t index )
+                    {
+                        encode( cells + index * block_cells_count,
+                                block_size( index, cells_count ),
+                                blocks[index] );
+                        return true;
+                    } );
+
+    // NOTE: The previous snapshot is kept intact until the new one is completely written
+    const rtl::wstring temp_filename = rtl::wstring( filename ) + rtl::wstring( temp_suffix );
+
+    if ( !write( temp_filename.c_str(), layout, blocks ) )
+    {
+        ::DeleteFileW( temp_filename.c_str() );
+        return false;
+    }
+
+    return ::MoveFileExW(
+               temp_filename.c_str(), filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH )
+        != FALSE;
+}
+
+bool Snapshot::load( const wchar_t* filename, const Layout& layout, rtl::uint32_t* cells )
+{
+    const MappedFile file( filename );
+
+    const auto*  data      = static_cast<const rtl::uint32_t*>( file.data() );
+    const size_t file_size = file.size();
+
+    if ( !data )
+        return false;
+
+    const auto* header = reinterpret_cast<const format::snapshot*>( data );
+
+    Layout file_layout = legacy_layout;
+
+    if ( file_size < sizeof( format::snapshot ) || header->id != format::signatures::clst )
+    {
+        // NOTE: Raw state dump
+        if ( file_size != file_layout.cells_count() * sizeof( rtl::uint32_t ) )
+            return false;
+
+        remap( file_layout, data, layout, cells );
+        return true;
+    }
+
+    size_t data_size = sizeof( format::snapshot ) / sizeof( rtl::uint32_t );
+
+    if ( header->version == format::versions::v2 )
+    {
+        if ( file_size < sizeof( format::snapshot ) + sizeof( format::layout ) )
+            return false;
+
+        const auto* grid = reinterpret_cast<const format::layout*>( data + data_size );
+
+        file_layout.grid_width  = grid->grid_width;
+        file_layout.grid_height = grid->grid_height;
+
+        data_size += sizeof( format::layout ) / sizeof( rtl::uint32_t );
+    }
+    // TODO: notify user if version mismatch detected
+    else if ( header->version != format::versions::v1 )
+    {
+        return false;
+    }
+
+    const size_t cells_count  = file_layout.cells_count();
+    const size_t blocks_count = ( cells_count + block_cells_count - 1 ) / block_cells_count;
+
+    if ( header->block_cells_count != block_cells_count || header->cells_count != cells_count
+         || header->blocks_count != blocks_count )
+        return false;
+
+    const rtl::uint32_t* sizes = data + data_size;
+
+    data_size += blocks_count;
+
+    if ( file_size < data_size * sizeof( rtl::uint32_t ) )
+        return false;
+
+    rtl::vector<size_t> offsets( blocks_count, 0 );
+
+    for ( size_t i = 0; i < blocks_count; ++i )
+    {
+        offsets[i] = data_size;
+        data_size += sizes[i];
+    }
+
+    if ( data_size * sizeof( rtl::uint32_t ) != file_size )
+        return false;
+
+    // NOTE: Cells of another layout are decoded to the temporary buffer and remapped afterwards
+    rtl::vector<rtl::uint32_t> file_cells;
+    rtl::uint32_t*             output = cells;
+
+    if ( file_layout != layout )
+    {
+        file_cells.resize( cells_count, 0 );
+        output = file_cells.data();
+    }
+
+    // NOTE: Blocks are decoded straight from the file mapping
+    const bool decoded = process_blocks( blocks_count,
+                                         false,
+                                         [&]( size_t index )
+                                         {
+                                             return decode( data + offsets[index],
+                                                            sizes[index],
+                                                            output + index * block_cells_count,
+                                                            block_size( index, cells_count ) );
+                                         } );
+
+    if ( !decoded )
+        return false;
+
+    if ( output != cells )
+        remap( file_layout, output, layout, cells );
+
+    return true;
+}
+
+void Snapshot::remap( const Layout&        from_layout,
+                      const rtl::uint32_t* from_cells,
+                      const Layout&        to_layout,
+                      rtl::uint32_t*       to_cells )
+{
+    for ( size_t y = 0; y < to_layout.grid_height; ++y )
+    {
+        const size_t from_y = y * from_layout.grid_height / to_layout.grid_height;
+
+        for ( size_t x = 0; x < to_layout.grid_width; ++x )
+        {
+            const size_t from_x = x * from_layout.grid_width / to_layout.grid_width;
+
+            to_cells[y * to_layout.grid_width + x]
+                = from_layout.grid_cells_count() != 0
+                    ? from_cells[from_y * from_layout.grid_width + from_x]
+                    : 0;
+        }
+    }
+
+    from_cells += from_layout.grid_cells_count();
+    to_cells += to_layout.grid_cells_count();
+
+    for ( size_t i = 0; i < Layout::tables_cells_count; ++i )
+        to_cells[i] = from_cells[i];
+}
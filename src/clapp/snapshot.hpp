@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#pragma once
+
+#include <rtl/vector.hpp>
+
+namespace clapp
+{
+    // State snapshot file. Cells are split into blocks, which are run-length encoded against
+    // zeros on all CPU cores. Snapshot is read through the file mapping.
+    class Snapshot final
+    {
+    public:
+        // NOTE: State consists of the grid of cells, which covers the screen, and the tables
+        struct Layout
+        {
+            static constexpr size_t tables_cells_count = 256 * 256 + 256 * 256;
+
+            rtl::uint32_t grid_width { 0 };
+            rtl::uint32_t grid_height { 0 };
+
+            size_t grid_cells_count() const
+            {
+                return static_cast<size_t>( grid_width ) * static_cast<size_t>( grid_height );
+            }
+
+            size_t cells_count() const { return grid_cells_count() + tables_cells_count; }
+
+            bool operator==( const Layout& other ) const
+            {
+                return grid_width == other.grid_width && grid_height == other.grid_height;
+            }
+
+            bool operator!=( const Layout& other ) const { return !( *this == other ); }
+        };
+
+        // NOTE: Writes to the temporary file first, then replaces \filename with it. The
+        // \background save encodes on a few cores only, so it doesn't stall the frames.
+        static bool save( const wchar_t*       filename,
+                          const Layout&        layout,
+                          const rtl::uint32_t* cells,
+                          bool                 background = false );
+
+        // NOTE: Snapshots of another layout and raw state dumps written by the previous versions
+        // are remapped to \layout
+        static bool load( const wchar_t* filename, const Layout& layout, rtl::uint32_t* cells );
+
+        // Scales the grid with the nearest neighbour filter and copies the tables
+        static void remap( const Layout&        from_layout,
+                           const rtl::uint32_t* from_cells,
+                           const Layout&        to_layout,
+                           rtl::uint32_t*       to_cells );
+
+    private:
+        Snapshot() = delete;
+    };
+}
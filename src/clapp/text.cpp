@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#include "text.hpp"
+
+using namespace clapp;
+
+Text& Text::append( rtl::wstring_view text )
+{
+    for ( wchar_t c : text )
+        append( c );
+
+    return *this;
+}
+
+Text& Text::append( wchar_t c )
+{
+    if ( m_size < capacity )
+        m_chars[m_size++] = c;
+
+    return *this;
+}
+
+Text& Text::append_integer( long long value )
+{
+    if ( value < 0 )
+        append( L'-' );
+
+    unsigned long long magnitude = value < 0 ? 0ull - static_cast<unsigned long long>( value )
+                                             : static_cast<unsigned long long>( value );
+
+    // NOTE: Enough for the digits of the 64-bit value
+    rtl::array<wchar_t, 20> digits;
+    size_t                  count = 0;
+
+    do
+    {
+        digits[count++] = static_cast<wchar_t>( L'0' + magnitude % 10 );
+        magnitude /= 10;
+    } while ( magnitude != 0 );
+
+    while ( count > 0 )
+        append( digits[--count] );
+
+    return *this;
+}
+
+Text& Text::append_decimal( float value )
+{
+    const long long tenths = static_cast<long long>( value * 10.f + ( value < 0.f ? -.5f : .5f ) );
+
+    if ( tenths < 0 )
+        append( L'-' );
+
+    const long long magnitude = tenths < 0 ? -tenths : tenths;
+
+    append_integer( magnitude / 10 );
+    append( L'.' );
+
+    return append( static_cast<wchar_t>( L'0' + magnitude % 10 ) );
+}
+
+bool Text::operator==( rtl::wstring_view text ) const
+{
+    if ( text.size() != m_size )
+        return false;
+
+    for ( size_t i = 0; i < m_size; ++i )
+    {
+        if ( text[i] != m_chars[i] )
+            return false;
+    }
+
+    return true;
+}
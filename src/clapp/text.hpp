@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2016-2022 Konstantin Polevik
+ * All rights reserved
+ *
+ * This file is part of the CLapp. Redistribution and use in source and
+ * binary forms, with or without modification, are permitted exclusively
+ * under the terms of the MIT license. You should have received a copy of the
+ * license with this file. If not, please visit:
+ * https://github.com/out61h/clapp/blob/main/LICENSE.
+ */
+#pragma once
+
+#include <rtl/array.hpp>
+#include <rtl/string.hpp>
+
+namespace clapp
+{
+    // Text of the fixed capacity, which is formatted without heap allocations.
+    // NOTE: The text, which exceeds the capacity, is truncated
+    class Text final
+    {
+    public:
+        static constexpr size_t capacity = 256;
+
+        Text& append( rtl::wstring_view text );
+        Text& append_integer( long long value );
+
+        // Appends value with one fractional digit
+        Text& append_decimal( float value );
+
+        void clear() { m_size = 0; }
+
+        bool empty() const { return m_size == 0; }
+
+        rtl::wstring_view view() const { return rtl::wstring_view( m_chars.data(), m_size ); }
+
+        bool operator==( rtl::wstring_view text ) const;
+
+    private:
+        Text& append( wchar_t c );
+
+        rtl::array<wchar_t, capacity> m_chars;
+        size_t                        m_size { 0 };
+    };
+}